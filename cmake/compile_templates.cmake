@@ -0,0 +1,59 @@
+function(target_compile_templates targ)
+  cmake_parse_arguments(PARSE_ARGV 1 ARG "TRIM_BLOCKS;LSTRIP_BLOCKS"
+    "HEADER;NAMESPACE" "INPUT")
+  set(flags)
+  if(ARG_TRIM_BLOCKS)
+    list(APPEND flags --trim-blocks)
+  endif()
+  if(ARG_LSTRIP_BLOCKS)
+    list(APPEND flags --lstrip-blocks)
+  endif()
+  # Generate Header, listing the templates of every call on the target
+  foreach(file_name IN LISTS ARG_INPUT)
+    get_filename_component(file_stem ${file_name} NAME_WE)
+    set_property(TARGET ${targ} APPEND PROPERTY
+      AUTO_FFI_COMPILED_TEMPLATES ${file_stem})
+  endforeach()
+  get_target_property(file_stems ${targ} AUTO_FFI_COMPILED_TEMPLATES)
+  if(NOT file_stems)
+    set(file_stems "")
+  endif()
+  set(declarations "")
+  set(entries "")
+  set(count 0)
+  foreach(file_stem IN LISTS file_stems)
+    string(MAKE_C_IDENTIFIER ${file_stem} file_id)
+    string(APPEND declarations
+      "void render_${file_id}(tpl::context& ctx, const tpl::module& mod);\n")
+    string(APPEND entries "    {\"${file_stem}\", &render_${file_id}},\n")
+    math(EXPR count "${count} + 1")
+  endforeach()
+  # Only replace the header if it changes, not to rebuild what includes it.
+  set(header_path "${CMAKE_CURRENT_BINARY_DIR}/${ARG_HEADER}")
+  file(WRITE "${header_path}.tmp"
+    "#pragma once\n"
+    "#include <array>\n"
+    "#include \"compiled_template.h\"\n"
+    "namespace ${ARG_NAMESPACE} {\n"
+    "${declarations}"
+    "inline constexpr std::array<tpl::compiled_template, ${count}>\n"
+    "  compiled_templates{{\n${entries}}};\n"
+    "}\n")
+  execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+    "${header_path}.tmp" "${header_path}")
+  # Generate Sources
+  foreach(file_name IN LISTS ARG_INPUT)
+    get_filename_component(input_path ${file_name} ABSOLUTE)
+    get_filename_component(file_stem ${file_name} NAME_WE)
+    string(MAKE_C_IDENTIFIER ${file_stem} file_id)
+    set(output_path "${CMAKE_CURRENT_BINARY_DIR}/${file_id}.template.cpp")
+    add_custom_command(OUTPUT ${output_path}
+      COMMAND auto-ffi-compile-template ${flags}
+        --name ${file_id} --namespace ${ARG_NAMESPACE}
+        --header ${ARG_HEADER} --output ${output_path} ${input_path}
+      DEPENDS auto-ffi-compile-template ${input_path}
+      COMMENT "Compiling template ${file_name}")
+    target_sources(${targ} PRIVATE ${output_path})
+  endforeach()
+  target_include_directories(${targ} PRIVATE ${CMAKE_CURRENT_BINARY_DIR})
+endfunction()
@@ -0,0 +1,451 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Compiles an inja template into a C++ function, rendering the same output
+// as inja would for the default data model of auto-FFI (see json.cpp). Only
+// the subset of inja the default template uses is supported: text, comments,
+// expressions, if/else if/else, for over lists and objects, and line
+// statements, with trim_blocks and lstrip_blocks.
+//
+// Usage: auto-ffi-compile-template [--trim-blocks] [--lstrip-blocks]
+//            --name <id> --namespace <ns> --header <header>
+//            --output <file.cpp> <template>
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+struct compile_error : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+struct options {
+  bool trim_blocks{false};
+  bool lstrip_blocks{false};
+  std::string name;
+  std::string name_space;
+  std::string header;
+  std::string output;
+  std::string input;
+};
+
+const std::set<std::string_view> functions{
+    "gen_type",        "gen_pure_type", "gen_name",
+    "gen_variable",    "gen_data_ctor", "gen_type_ctor",
+    "gen_module_name", "gen_scoped",    "length",
+};
+
+std::string cpp_string(std::string_view s) {
+  std::string res{'"'};
+  for (const auto c : s) switch (c) {
+      case '"':
+        res += "\\\"";
+        break;
+      case '\\':
+        res += "\\\\";
+        break;
+      case '\n':
+        res += "\\n";
+        break;
+      case '\t':
+        res += "\\t";
+        break;
+      case '\r':
+        res += "\\r";
+        break;
+      case '?':
+        // avoid trigraphs
+        res += "\\?";
+        break;
+      default:
+        res += c;
+    }
+  return res += '"';
+}
+
+// Expressions and statements inside a tag.
+class tag_parser {
+ public:
+  tag_parser(std::string_view input, size_t line,
+             const std::vector<std::set<std::string>>& scopes)
+      : input{input}, line{line}, scopes{scopes} {
+    tokenize();
+  }
+
+  bool at_end() const { return pos == tokens.size(); }
+  bool accept(std::string_view t) {
+    if (at_end() || tokens[pos] != t) return false;
+    ++pos;
+    return true;
+  }
+  void expect(std::string_view t) {
+    if (!accept(t)) fail("expected '" + std::string{t} + "'");
+  }
+  void expect_end() {
+    if (!at_end()) fail("unexpected '" + tokens[pos] + "'");
+  }
+  std::string identifier() {
+    if (at_end() || !is_identifier(tokens[pos])) fail("expected a name");
+    return tokens[pos++];
+  }
+
+  // Any value, as a C++ expression.
+  std::string expression() { return or_expr(); }
+  // A C++ expression of type bool.
+  std::string condition() { return "ctx.truthy(" + expression() + ")"; }
+
+  [[noreturn]] void fail(const std::string& msg) const {
+    throw compile_error{"line " + std::to_string(line) + ": " + msg +
+                        " in '" + std::string{input} + "'"};
+  }
+
+ private:
+  static bool is_identifier(std::string_view t) {
+    return !t.empty() && (std::isalpha(static_cast<unsigned char>(t[0])) ||
+                          t[0] == '_');
+  }
+
+  void tokenize() {
+    for (size_t i = 0; i < input.size();) {
+      const auto c = input[i];
+      if (std::isspace(static_cast<unsigned char>(c))) {
+        ++i;
+      } else if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
+        auto j = i;
+        while (j < input.size() &&
+               (std::isalnum(static_cast<unsigned char>(input[j])) ||
+                input[j] == '_'))
+          ++j;
+        tokens.emplace_back(input.substr(i, j - i));
+        i = j;
+      } else if (c == '"') {
+        auto j = i + 1;
+        while (j < input.size() && input[j] != '"')
+          j += input[j] == '\\' ? 2 : 1;
+        if (j >= input.size()) fail("unterminated string");
+        tokens.emplace_back(input.substr(i, j + 1 - i));
+        i = j + 1;
+      } else if (input.substr(i, 2) == "==" || input.substr(i, 2) == "!=" ||
+                 input.substr(i, 2) == "<=" || input.substr(i, 2) == ">=") {
+        tokens.emplace_back(input.substr(i, 2));
+        i += 2;
+      } else if (std::string_view{"().,<>"}.find(c) != std::string_view::npos) {
+        tokens.emplace_back(1, c);
+        ++i;
+      } else {
+        fail(std::string{"unexpected character '"} + c + "'");
+      }
+    }
+  }
+
+  std::string or_expr() {
+    auto res = and_expr();
+    while (accept("or"))
+      res = "(ctx.truthy(" + res + ") || ctx.truthy(" + and_expr() + "))";
+    return res;
+  }
+
+  std::string and_expr() {
+    auto res = not_expr();
+    while (accept("and"))
+      res = "(ctx.truthy(" + res + ") && ctx.truthy(" + not_expr() + "))";
+    return res;
+  }
+
+  std::string not_expr() {
+    if (accept("not")) return "!ctx.truthy(" + not_expr() + ")";
+    return comparison();
+  }
+
+  std::string comparison() {
+    auto res = primary();
+    for (const auto op : {"==", "!=", "<=", ">=", "<", ">"})
+      if (accept(op)) return "(" + res + " " + op + " " + primary() + ")";
+    return res;
+  }
+
+  std::string primary() {
+    if (at_end()) fail("expected an expression");
+    const auto t = tokens[pos];
+    if (accept("(")) {
+      auto res = expression();
+      expect(")");
+      return res;
+    }
+    if (t == "true" || t == "false") return tokens[pos++];
+    if (t.front() == '"') {
+      ++pos;
+      return "std::string_view{" + t + "}";
+    }
+    if (std::isdigit(static_cast<unsigned char>(t.front()))) {
+      ++pos;
+      return t;
+    }
+    const auto name = identifier();
+    if (accept("(")) {
+      if (functions.count(name) == 0) fail("unknown function '" + name + "'");
+      std::string args;
+      if (!accept(")")) {
+        do args += (args.empty() ? "" : ", ") + expression();
+        while (accept(","));
+        expect(")");
+      }
+      return "ctx." + name + "(" + args + ")";
+    }
+    if (!in_scope(name)) fail("unknown variable '" + name + "'");
+    auto res = "v_" + name;
+    while (accept(".")) res += "." + identifier();
+    return res;
+  }
+
+  bool in_scope(const std::string& name) const {
+    for (const auto& s : scopes)
+      if (s.count(name)) return true;
+    return false;
+  }
+
+  std::string_view input;
+  size_t line;
+  const std::vector<std::set<std::string>>& scopes;
+  std::vector<std::string> tokens;
+  size_t pos{0};
+};
+
+class template_compiler {
+ public:
+  explicit template_compiler(const options& opts) : opts{opts} {}
+
+  std::string compile(std::string_view input) {
+    scopes.push_back({"module", "cfg"});
+    size_t pos = 0;
+    while (pos < input.size()) {
+      const auto open = find_open(input, pos);
+      text += input.substr(pos, open - pos);
+      if (open == input.size()) break;
+      const auto line = line_of(input, open);
+      if (input.substr(open, 2) == "##") {
+        auto close = input.find('\n', open);
+        if (close == std::string_view::npos) close = input.size();
+        statement(input.substr(open + 2, close - open - 2), line);
+        pos = close == input.size() ? close : close + 1;
+        continue;
+      }
+      const auto kind = input[open + 1];
+      const std::string_view closer = kind == '{' ? "}}"
+                                      : kind == '%' ? "%}"
+                                                    : "#}";
+      const auto close = input.find(closer, open + 2);
+      if (close == std::string_view::npos)
+        throw compile_error{"line " + std::to_string(line) + ": missing '" +
+                            std::string{closer} + "'"};
+      const auto body = input.substr(open + 2, close - open - 2);
+      pos = close + 2;
+      if (kind == '{') {
+        flush_text();
+        tag_parser p{body, line, scopes};
+        const auto e = p.expression();
+        p.expect_end();
+        emit("ctx.print(" + e + ");");
+      } else if (kind == '%') {
+        if (opts.lstrip_blocks) lstrip_text();
+        statement(body, line);
+        if (opts.trim_blocks && pos < input.size() && input[pos] == '\n')
+          ++pos;
+      }
+    }
+    flush_text();
+    if (scopes.size() != 1 || !blocks.empty())
+      throw compile_error{"unterminated '" + blocks.back() + "'"};
+
+    std::ostringstream os;
+    os << "// Generated by auto-ffi-compile-template from " << opts.input
+       << ", do not edit.\n"
+       << "#include \"" << opts.header << "\"\n\n"
+       << "void " << opts.name_space << "::render_" << opts.name
+       << "(::ffi::tpl::context& ctx, const ::ffi::tpl::module& v_module) {\n"
+       << "  const auto& v_cfg = ctx.cfg;\n"
+       << "  static_cast<void>(v_cfg);\n"
+       << code << "}\n";
+    return os.str();
+  }
+
+ private:
+  // Next '{{', '{%', '{#', or '##' at the beginning of a line.
+  static size_t find_open(std::string_view input, size_t pos) {
+    for (auto i = pos; i + 1 < input.size(); ++i) {
+      const auto c = input[i], d = input[i + 1];
+      if (c == '{' && (d == '{' || d == '%' || d == '#')) return i;
+      if (c == '#' && d == '#' && (i == 0 || input[i - 1] == '\n')) return i;
+    }
+    return input.size();
+  }
+
+  static size_t line_of(std::string_view input, size_t pos) {
+    size_t res = 1;
+    for (size_t i = 0; i < pos; ++i) res += input[i] == '\n';
+    return res;
+  }
+
+  // Remove spaces and tabs before a block on its own line.
+  void lstrip_text() {
+    auto p = text.find_last_not_of(" \t");
+    if (p == std::string::npos || text[p] == '\n') text.erase(p + 1);
+  }
+
+  void statement(std::string_view body, size_t line) {
+    tag_parser p{body, line, scopes};
+    if (p.accept("for")) {
+      auto first = p.identifier(), second = std::string{};
+      if (p.accept(",")) second = p.identifier();
+      p.expect("in");
+      const auto range = p.expression();
+      p.expect_end();
+      flush_text();
+      const auto id = std::to_string(counter++);
+      emit("{");
+      indent += 2;
+      emit("const auto& range_" + id + " = " + range + ";");
+      emit("size_t index_" + id + " = 0;");
+      emit(second.empty()
+               ? "for (const auto& v_" + first + " : range_" + id + ") {"
+               : "for (const auto& [v_" + first + ", v_" + second +
+                     "] : range_" + id + ") {");
+      indent += 2;
+      emit("const ::ffi::tpl::loop v_loop{index_" + id + ", range_" + id +
+           ".size()};");
+      emit("++index_" + id + ";");
+      emit("static_cast<void>(v_loop);");
+      emit("static_cast<void>(v_" + first + ");");
+      if (!second.empty()) emit("static_cast<void>(v_" + second + ");");
+      scopes.push_back({first, second, "loop"});
+      blocks.emplace_back("for");
+    } else if (p.accept("endfor")) {
+      p.expect_end();
+      close_block(p, "for");
+      scopes.pop_back();
+      indent -= 2;
+      emit("}");
+      indent -= 2;
+      emit("}");
+    } else if (p.accept("if")) {
+      const auto cond = p.condition();
+      p.expect_end();
+      flush_text();
+      emit("if (" + cond + ") {");
+      indent += 2;
+      blocks.emplace_back("if");
+    } else if (p.accept("else")) {
+      std::string cond;
+      if (p.accept("if")) cond = p.condition();
+      p.expect_end();
+      if (blocks.empty() || blocks.back() != "if") p.fail("unexpected 'else'");
+      flush_text();
+      indent -= 2;
+      emit(cond.empty() ? "} else {" : "} else if (" + cond + ") {");
+      indent += 2;
+    } else if (p.accept("endif")) {
+      p.expect_end();
+      close_block(p, "if");
+      indent -= 2;
+      emit("}");
+    } else {
+      p.fail("unsupported statement");
+    }
+  }
+
+  void close_block(const tag_parser& p, const std::string& kind) {
+    if (blocks.empty() || blocks.back() != kind)
+      p.fail("unexpected 'end" + kind + "'");
+    blocks.pop_back();
+    flush_text();
+  }
+
+  void flush_text() {
+    if (text.empty()) return;
+    emit("ctx.text(" + cpp_string(text) + ");");
+    text.clear();
+  }
+
+  void emit(const std::string& s) {
+    code.append(indent, ' ').append(s).push_back('\n');
+  }
+
+  const options& opts;
+  std::vector<std::set<std::string>> scopes;
+  std::vector<std::string> blocks;
+  std::string text;
+  std::string code;
+  size_t indent{2};
+  size_t counter{0};
+};
+
+options parse_options(int argc, char* argv[]) {
+  options res;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const auto value = [&]() -> std::string {
+      if (i + 1 == argc)
+        throw compile_error{"missing value for '" + std::string{arg} + "'"};
+      return argv[++i];
+    };
+    if (arg == "--trim-blocks")
+      res.trim_blocks = true;
+    else if (arg == "--lstrip-blocks")
+      res.lstrip_blocks = true;
+    else if (arg == "--name")
+      res.name = value();
+    else if (arg == "--namespace")
+      res.name_space = value();
+    else if (arg == "--header")
+      res.header = value();
+    else if (arg == "--output")
+      res.output = value();
+    else
+      res.input = arg;
+  }
+  if (res.name.empty() || res.name_space.empty() || res.header.empty() ||
+      res.output.empty() || res.input.empty())
+    throw compile_error{"missing arguments"};
+  return res;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    const auto opts = parse_options(argc, argv);
+    std::ifstream ifs{opts.input, std::ios::in | std::ios::binary};
+    if (!ifs) throw compile_error{"cannot open '" + opts.input + "'"};
+    std::ostringstream contents;
+    contents << ifs.rdbuf();
+    const auto code = template_compiler{opts}.compile(contents.str());
+    std::ofstream ofs{opts.output, std::ios::out | std::ios::binary};
+    ofs << code;
+    if (!ofs) throw compile_error{"cannot write '" + opts.output + "'"};
+  } catch (const compile_error& e) {
+    std::cerr << "auto-ffi-compile-template: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "compiled_template.h"
+
+#include <nlohmann/json.hpp>
+
+#include "haskell_code_gen.h"
+#include "json.h"
+
+ffi::tpl::module ffi::tpl::make_module(const std::string& name,
+                                       const module_contents& mod) {
+  module res{name, mod.imports, {}, {}, {}};
+  for (const auto& [v, info] : mod.entities)
+    res.entities.push_back({v, info.type, info.unsafe, info.pure});
+  for (const auto& [t, tag] : mod.tags)
+    if (const auto s = std::get_if<ffi::structure>(&tag.payload)) {
+      const auto& layout = s->layout;
+      auto& record = res.structs.emplace_back(structure{
+          t, {}, layout.has_value(), layout ? layout->size : 0,
+          layout ? layout->alignment : 0});
+      for (size_t i = 0; i < s->fields.size(); ++i)
+        record.fields.push_back({s->fields[i].first, s->fields[i].second,
+                                 layout ? layout->offsets[i] : 0});
+    } else {
+      const auto& enm = std::get<ffi::enumeration>(tag.payload);
+      res.enums.push_back({t, enm.underlying_type, enm.values});
+    }
+  return res;
+}
+
+std::string ffi::tpl::context::gen_type(const ctype* type) {
+  return gen.gen_type(*type);
+}
+
+std::string ffi::tpl::context::gen_pure_type(const ctype* type) {
+  return gen.gen_pure_type(*type);
+}
+
+std::string_view ffi::tpl::context::gen_name(std::string_view variant,
+                                             std::string_view n) {
+  return gen.gen_name(nlohmann::json(variant).get<name_variant>(), n);
+}
+
+std::string_view ffi::tpl::context::gen_variable(std::string_view n) {
+  return gen.gen_name(name_variant::variable, n);
+}
+
+std::string_view ffi::tpl::context::gen_data_ctor(std::string_view n) {
+  return gen.gen_name(name_variant::data_ctor, n);
+}
+
+std::string_view ffi::tpl::context::gen_type_ctor(std::string_view n) {
+  return gen.gen_name(name_variant::type_ctor, n);
+}
+
+std::string_view ffi::tpl::context::gen_module_name(std::string_view n) {
+  return gen.gen_name(name_variant::module_name, n);
+}
+
+std::string_view ffi::tpl::context::gen_scoped(std::string_view n,
+                                               std::string_view scope) {
+  return gen.gen_name(name_variant::variable, n, scope);
+}
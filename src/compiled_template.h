@@ -0,0 +1,140 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "config.h"
+#include "module.h"
+
+namespace ffi {
+class haskell_code_gen;
+
+// Runtime support for templates compiled to C++ by auto-ffi-compile-template.
+// The data model mirrors the JSON passed to Inja (see json.cpp).
+namespace tpl {
+struct entity {
+  std::string_view name;
+  const ctype* type;
+  bool unsafe;
+  bool pure;
+};
+
+struct field {
+  std::string_view name;
+  const ctype* type;
+  // only if the structure has a layout
+  uint64_t offset;
+};
+
+struct structure {
+  std::string_view name;
+  std::vector<field> fields;
+  bool has_layout;
+  uint64_t size;
+  uint64_t alignment;
+};
+
+struct enumeration {
+  std::string_view name;
+  const ctype* underlying_type;
+  const std::map<std::string, intmax_t, std::less<>>& enumerators;
+};
+
+struct module {
+  std::string_view name;
+  const std::vector<std::string>& imports;
+  std::vector<structure> structs;
+  std::vector<enumeration> enums;
+  std::vector<entity> entities;
+};
+
+module make_module(const std::string& name, const module_contents& mod);
+
+// The 'loop' variable in Inja for-loops.
+struct loop {
+  loop(size_t i, size_t n)
+      : index{i}, index1{i + 1}, is_first{i == 0}, is_last{i + 1 == n} {}
+  size_t index;
+  size_t index1;
+  bool is_first;
+  bool is_last;
+};
+
+// Callbacks and output for compiled templates.
+class context {
+ public:
+  context(haskell_code_gen& gen, const config& cfg, llvm::raw_ostream& os)
+      : cfg{cfg}, gen{gen}, os{os} {}
+
+  std::string gen_type(const ctype* type);
+  std::string gen_pure_type(const ctype* type);
+  std::string_view gen_name(std::string_view variant, std::string_view n);
+  std::string_view gen_variable(std::string_view n);
+  std::string_view gen_data_ctor(std::string_view n);
+  std::string_view gen_type_ctor(std::string_view n);
+  std::string_view gen_module_name(std::string_view n);
+  std::string_view gen_scoped(std::string_view n, std::string_view scope);
+
+  template <typename R>
+  static size_t length(const R& range) {
+    return std::size(range);
+  }
+
+  // Truthiness of values in Inja conditions.
+  template <typename T>
+  static bool truthy(const T& value) {
+    if constexpr (std::is_arithmetic_v<T>)
+      return value != 0;
+    else
+      return !std::empty(value);
+  }
+
+  void text(std::string_view s) { os << llvm::StringRef{s.data(), s.size()}; }
+  void print(std::string_view s) { text(s); }
+  void print(const std::string& s) { os << s; }
+  void print(bool b) { os << (b ? "true" : "false"); }
+  template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+  void print(T value) {
+    if constexpr (std::is_signed_v<T>)
+      os << static_cast<long long>(value);
+    else
+      os << static_cast<unsigned long long>(value);
+  }
+
+  const config& cfg;
+
+ private:
+  haskell_code_gen& gen;
+  llvm::raw_ostream& os;
+};
+
+struct compiled_template {
+  std::string_view name;
+  void (*render)(context& ctx, const module& mod);
+};
+}  // namespace tpl
+}  // namespace ffi
@@ -1,52 +1,64 @@
 #include "config.h"
 
-#include <set>
+#include <llvm/Support/Path.h>
 
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
 
 bool ffi::validate_config(const config& cfg, spdlog::logger& logger) {
-  if (cfg.generate_storable_instances)
-    logger.warn(
-        "Clang provides no interface to determine whether a struct is packed "
-        "or not, so we pretend all structs are not packed and generate normal "
-        "Storable instances for them. If you use the generated Storable "
-        "instances on a packed struct, the behaviour is undefined.");
-  return true;
+  bool valid = true;
+  for (const auto* patterns :
+       {&cfg.unsafe_calls, &cfg.safe_calls, &cfg.pure_calls})
+    for (const auto& p : *patterns)
+      if (auto glob = llvm::GlobPattern::create(p); !glob) {
+        logger.error("Invalid glob pattern '{}': {}.", p,
+                     llvm::toString(glob.takeError()));
+        valid = false;
+      }
+  return valid;
 }
 
-namespace {
-const std::set<std::string_view> haskell_keywords{
-    "as",        "case",   "class",  "data",    "default", "deriving",
-    "do",        "else",   "forall", "foreign", "hiding",  "if",
-    "in",        "import", "infix",  "infixl",  "infixr",  "instance",
-    "let",       "mdo",    "module", "newtype", "of",      "proc",
-    "qualified", "rec",    "then",   "type",    "where",
-};
-}  // namespace
+std::vector<llvm::GlobPattern> ffi::make_globs(
+    const std::vector<std::string>& patterns) {
+  std::vector<llvm::GlobPattern> res;
+  for (const auto& p : patterns)
+    if (auto glob = llvm::GlobPattern::create(p))
+      res.push_back(std::move(*glob));
+    else
+      llvm::consumeError(glob.takeError());
+  return res;
+}
+
+std::string ffi::cache_directory(const config& cfg) {
+  llvm::SmallString<128> dir{cfg.output_directory};
+  llvm::sys::path::append(dir, ".auto-ffi");
+  return dir.str().str();
+}
 
 int ffi::name_clashes(const name_resolver::rev_name_map& m,
                       spdlog::logger& logger, std::string_view kind,
                       std::string_view scope) {
-  auto conflict{0};
-  for (auto it = begin(m); it != end(m);) {
-    const auto cur = it->first;
-    const bool key_clash = haskell_keywords.find(cur) != end(haskell_keywords);
-    // no clash
-    if (const auto n = next(it);
-        !key_clash && (n == end(m) || n->first != cur)) {
-      ++it;
-      continue;
-    }
+  const auto clashes = m.clashes();
+  for (const auto g : clashes) {
     // clash with a keyword or with each other
     fmt::memory_buffer buf;
     format_to(buf, "the following {} names in '{}' all convert to '{}':", kind,
-              scope, cur);
-    for (; it != end(m) && it->first == cur; ++it)
-      format_to(buf, "\n- {}", it->second);
+              scope, g->name);
+    for (const auto& source : g->sources) format_to(buf, "\n- {}", source);
     logger.error(to_string(buf));
-    if (key_clash) logger.info("'{}' is a Haskell keyword.", cur);
-    ++conflict;
+    if (is_haskell_keyword(g->name))
+      logger.info("'{}' is a Haskell keyword.", g->name);
+  }
+  return static_cast<int>(clashes.size());
+}
+
+int ffi::name_clashes(const config& cfg, spdlog::logger& logger) {
+  int nc{0};
+  nc += name_clashes(cfg.rev_modules, logger, "module", "(global)");
+  for (const auto& [mod, m] : cfg.explicit_name_mapping) {
+    nc += name_clashes(m.rev_variables, logger, "variable", mod);
+    nc += name_clashes(m.rev_data_ctors, logger, "data ctor", mod);
+    nc += name_clashes(m.rev_type_ctors, logger, "type ctor", mod);
   }
-  return conflict;
+  return nc;
 }
@@ -18,13 +18,15 @@
 #pragma once
 
 #include <map>
-#include <unordered_map>
 #include <vector>
 
+#include <llvm/Support/GlobPattern.h>
+
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
 #include "name_converter.h"
+#include "name_table.h"
 
 namespace ffi {
 struct name_converter_bundle {
@@ -34,32 +36,22 @@ struct name_converter_bundle {
   cvt for_type{name_case::camel, name_variant::type_ctor, &for_all};
   cvt for_ctor{name_case::camel, name_variant::data_ctor, &for_all};
   cvt for_var{name_case::camel, name_variant::variable, &for_all};
-};
-
-struct scoped_name;
-
-struct scoped_name_view {
-  std::string_view scope{};
-  std::string_view name{};
-
-  scoped_name materialize() const;
-};
-
-struct scoped_name {
-  std::string scope{};
-  std::string name{};
 
-  operator scoped_name_view() const { return {scope, name}; }
+  name_converter_bundle() = default;
+  // A copy forwards to its own 'for_all'.
+  name_converter_bundle(const name_converter_bundle& other) { *this = other; }
+  name_converter_bundle& operator=(const name_converter_bundle& other) {
+    for_all = other.for_all;
+    for_module = other.for_module;
+    for_type = other.for_type;
+    for_ctor = other.for_ctor;
+    for_var = other.for_var;
+    for (auto c : {&for_module, &for_type, &for_ctor, &for_var})
+      c->forward_converter = &for_all;
+    return *this;
+  }
 };
 
-inline scoped_name scoped_name_view::materialize() const {
-  return {std::string{scope}, std::string{name}};
-}
-
-inline bool operator<(scoped_name_view n1, scoped_name_view n2) {
-  return n1.scope < n2.scope || (n1.scope == n2.scope && n1.name < n2.name);
-}
-
 // According to Haskell 2010 Report, there are six kinds of names in Haskell:
 // those for variables and constructors denote values; those for type
 // variables, type constructors, and type classes refer to entities related to
@@ -71,13 +63,12 @@ inline bool operator<(scoped_name_view n1, scoped_name_view n2) {
 // - An identifier must not be used as the name of a type constructor and a
 // class in the same scope.
 struct name_resolver {
-  using name_map = std::map<scoped_name, std::string, std::less<>>;
+  using name_map = name_table;
   name_map type_ctors;
   name_map data_ctors;
   name_map variables;
   // internal, should not be exported to config files
-  using rev_name_map =
-      std::unordered_multimap<std::string_view, scoped_name_view>;
+  using rev_name_map = clash_index;
   rev_name_map rev_type_ctors;
   rev_name_map rev_data_ctors;
   rev_name_map rev_variables;
@@ -89,6 +80,7 @@ struct config {
   bool warn_no_c_linkage{true};
   bool warn_no_external_formal_linkage{false};
   bool generate_storable_instances{true};
+  bool unity_build{false};
   name_converter_bundle name_converters;
   name_converter_map file_name_converters{};
   std::string library_name{"Library"};
@@ -97,19 +89,35 @@ struct config {
   std::vector<std::string> file_names{};
   std::vector<std::string> is_header_group{};
   std::vector<std::string> compiler_options{};
+  std::string compilation_database{};
+  std::vector<std::string> precompiled_prelude{};
   name_resolver::name_map module_name_mapping{};
   std::map<std::string, name_resolver, std::less<>> explicit_name_mapping{};
+  std::vector<std::string> unsafe_calls{};
+  std::vector<std::string> safe_calls{};
+  std::vector<std::string> pure_calls{};
   bool inja_set_trim_blocks{false};
   bool inja_set_lstrip_blocks{false};
   std::string custom_template{};
+  std::string compiled_template{};
   // internal, should not be exported to config files
   name_resolver::rev_name_map rev_modules;
 };
 
 bool validate_config(const config& cfg, spdlog::logger& logger);
 
+// Compile glob patterns in the configuration, dropping invalid ones (those
+// are reported by 'validate_config').
+std::vector<llvm::GlobPattern> make_globs(
+    const std::vector<std::string>& patterns);
+
+// Directory for files auto-FFI keeps between runs.
+std::string cache_directory(const config& cfg);
+
 int name_clashes(const name_resolver::rev_name_map& m, spdlog::logger& logger,
                  std::string_view kind, std::string_view scope);
+// Report all the name clashes in 'cfg', returns the number of them.
+int name_clashes(const config& cfg, spdlog::logger& logger);
 }  // namespace ffi
 
 template <>
@@ -121,6 +129,3 @@ struct fmt::formatter<ffi::scoped_name_view> : formatter<std::string_view> {
         context);
   }
 };
-
-template <>
-struct fmt::formatter<ffi::scoped_name> : formatter<ffi::scoped_name_view> {};
@@ -31,6 +31,19 @@ data {{ gen_type_ctor(s.name) }} = {{ gen_data_ctor(s.name) }}
 ##   endif
 ##   if cfg.generate_storable_instances
 instance Storable {{ gen_type_ctor(s.name) }} where
+##     if s.has_layout
+  sizeOf _ = {{ s.size }}
+  alignment _ = {{ s.alignment }}
+  peek _p'0 = {% if not length(s.fields) %}pure {% endif %}{{ gen_data_ctor(s.name) }}
+##       for field in s.fields
+    {% if loop.is_first %}<$>{% else %}<*>{% endif %} peekByteOff _p'0 {{ field.offset }}
+##       endfor
+  poke _p'0 _r'0 = do
+##       for field in s.fields
+    pokeByteOff _p'0 {{ field.offset }} ({{ gen_scoped(field.name, s.name) }} _r'0)
+##       endfor
+    pure ()
+##     else
   sizeOf _ =
     let sizeAlign x = (sizeOf x, alignment x)
         makeSize = foldl' (\sz (sx, ax) -> alignTo sz ax + sx) 0
@@ -42,19 +55,20 @@ instance Storable {{ gen_type_ctor(s.name) }} where
         makeSize = foldl' (\sz (sx, ax) -> alignTo sz ax + sx) 0
         alignTo s a = ((s + a - 1) `quot` a) * a
         offsets = map makeSize $ inits [{% for field in s.fields %}sizeAlign (undefined :: {{ gen_type(field.type) }}){% if not loop.is_last %}, {% endif %}{% endfor %}]
-    in Record
-##     for _ in s.fields
+    in {{ gen_data_ctor(s.name) }}
+##       for _ in s.fields
     {% if loop.is_first %}<$>{% else %}<*>{% endif %} peekByteOff _p'0 (offsets !! {{ loop.index }})
-##     endfor
+##       endfor
   poke _p'0 _r'0 =
     let sizeAlign x = (sizeOf x, alignment x)
         makeSize = foldl' (\sz (sx, ax) -> alignTo sz ax + sx) 0
         alignTo s a = ((s + a - 1) `quot` a) * a
         offsets = map makeSize $ inits [{% for field in s.fields %}sizeAlign (undefined :: {{ gen_type(field.type) }}){% if not loop.is_last %}, {% endif %}{% endfor %}]
     in do
-##     for field in s.fields
+##       for field in s.fields
     pokeByteOff _p'0 (offsets !! {{ loop.index }}) ({{ gen_scoped(field.name, s.name) }} _r'0)
-##     endfor
+##       endfor
+##     endif
 ##   endif
 ## endfor
 
@@ -69,5 +83,9 @@ pattern {{ gen_type_ctor(name) }} = {{ gen_data_ctor(e.name) }} {{ value }}
 ## endfor
 
 ## for e in module.entities
-foreign import ccall "{{ e.name }}" {{ gen_variable(e.name) }} :: {{ gen_type(e.type) }}
+##   if e.pure
+foreign import ccall {% if e.unsafe %}unsafe {% endif %}"{{ e.name }}" {{ gen_variable(e.name) }} :: {{ gen_pure_type(e.type) }}
+##   else
+foreign import ccall {% if e.unsafe %}unsafe {% endif %}"{{ e.name }}" {{ gen_variable(e.name) }} :: {{ gen_type(e.type) }}
+##   endif
 ## endfor
@@ -17,34 +17,288 @@
 
 #include "driver.h"
 
+#include <utility>
+
+#include <clang/Tooling/CommonOptionsParser.h>
+#include <clang/Tooling/JSONCompilationDatabase.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/xxhash.h>
+
 #include <fmt/format.h>
+#include <spdlog/spdlog.h>
 
+#include "parallel.h"
 #include "visit_types.h"
 
+namespace {
+bool is_header_group(const ffi::config& cfg, std::string_view module) {
+  return cfg.is_header_group.cend() != std::find(cfg.is_header_group.cbegin(),
+                                                 cfg.is_header_group.cend(),
+                                                 module);
+}
+
+struct unity_consumer_factory {
+  ffi::config& cfg;
+  ffi::type_arena& types;
+  ffi::module_list& modules;
+  llvm::ArrayRef<std::string> files;
+
+  std::unique_ptr<clang::ASTConsumer> newASTConsumer() {
+    return std::make_unique<ffi::unity_collector>(cfg, types, modules, files);
+  }
+};
+}  // namespace
+
+std::string ffi::module_name_of(const config& cfg, llvm::StringRef file) {
+  llvm::SmallString<0> path{file.begin(), file.end()};
+  llvm::sys::fs::make_absolute(path);
+  llvm::sys::path::replace_path_prefix(path, cfg.root_directory, "");
+  return llvm::sys::path::relative_path(path.str()).str();
+}
+
+std::string ffi::compilation_database_file(const config& cfg) {
+  if (cfg.compilation_database.empty()) return {};
+  llvm::SmallString<128> path{cfg.compilation_database};
+  if (llvm::sys::fs::is_directory(path))
+    llvm::sys::path::append(path, "compile_commands.json");
+  return path.str().str();
+}
+
+std::unique_ptr<clang::tooling::CompilationDatabase> ffi::make_compilations(
+    const config& cfg, std::string& error) {
+  using namespace clang::tooling;
+  if (cfg.compilation_database.empty())
+    return std::make_unique<FixedCompilationDatabase>(
+        cfg.root_directory.empty() ? "." : cfg.root_directory,
+        cfg.compiler_options);
+  auto db = JSONCompilationDatabase::loadFromFile(
+      compilation_database_file(cfg), error, JSONCommandLineSyntax::AutoDetect);
+  if (!db) return nullptr;
+  auto res = std::make_unique<ArgumentsAdjustingCompilations>(
+      inferMissingCompileCommands(std::move(db)));
+  if (!cfg.compiler_options.empty())
+    res->appendArgumentsAdjuster(getInsertArgumentAdjuster(
+        cfg.compiler_options, ArgumentInsertPosition::END));
+  return res;
+}
+
+std::vector<std::string> ffi::source_files(const clang::SourceManager& sm) {
+  std::vector<std::string> res;
+  for (auto p = sm.fileinfo_begin(); p != sm.fileinfo_end(); ++p) {
+    const auto* file = p->first;
+    llvm::SmallString<128> path{file->tryGetRealPathName()};
+    if (path.empty()) {
+      path = file->getName();
+      llvm::sys::fs::make_absolute(path);
+    }
+    // Files only in memory, e.g. the unity header, are never up to date.
+    if (!llvm::sys::fs::exists(path)) continue;
+    res.emplace_back(path.str());
+  }
+  std::sort(begin(res), end(res));
+  res.erase(std::unique(begin(res), end(res)), end(res));
+  return res;
+}
+
+void ffi::merge_modules(module_list& to, module_list&& from) {
+  for (auto& [name, mod] : from) {
+    auto [p, inserted] = to.try_emplace(name);
+    if (inserted) {
+      p->second = std::move(mod);
+      continue;
+    }
+    p->second.entities.merge(mod.entities);
+    p->second.tags.merge(mod.tags);
+    auto& imports = p->second.imports;
+    imports.insert(end(imports), std::make_move_iterator(begin(mod.imports)),
+                   std::make_move_iterator(end(mod.imports)));
+    auto& deps = p->second.dependencies;
+    deps.insert(end(deps), begin(mod.dependencies), end(mod.dependencies));
+    std::sort(begin(deps), end(deps));
+    deps.erase(std::unique(begin(deps), end(deps)), end(deps));
+  }
+}
+
 clang::FrontendAction* ffi::ffi_driver::create() {
-  return new info_collect_action{cfg, modules};
+  return new info_collect_action{cfg, types, modules};
+}
+
+int ffi::ffi_driver::run(
+    const clang::tooling::CompilationDatabase& compilations,
+    llvm::ArrayRef<std::string> files, unsigned jobs) {
+  if (cfg.unity_build) {
+    const auto status = run_unity(compilations, files);
+    add_dependencies(files);
+    if (sink && status == 0)
+      for (auto& m : std::exchange(modules, {})) sink(std::move(m));
+    return status;
+  }
+  if (!sink && (jobs <= 1 || files.size() <= 1)) {
+    clang::tooling::ClangTool tool{compilations, files};
+    if (arguments_adjuster) tool.appendArgumentsAdjuster(arguments_adjuster);
+    const auto status = tool.run(this);
+    add_dependencies(files);
+    return status;
+  }
+
+  // Every TU gets its own shard, so that workers never share a module list.
+  std::vector<module_list> shards(files.size());
+  std::vector<int> status(files.size());
+  parallel_for(jobs, files.size(), [&](unsigned, size_t i) {
+    // A physical file system has its own working directory, so workers do
+    // not race on the process-wide one.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs{
+        llvm::vfs::createPhysicalFileSystem().release()};
+    clang::tooling::ClangTool tool{
+        compilations, files[i],
+        std::make_shared<clang::PCHContainerOperations>(), fs};
+    tool.setRestoreWorkingDir(false);
+    if (arguments_adjuster) tool.appendArgumentsAdjuster(arguments_adjuster);
+    info_collect_factory factory{cfg, types, shards[i]};
+    status[i] = tool.run(&factory);
+    for (auto& m : shards[i]) merge_dependencies(m.second);
+    if (sink && status[i] == 0)
+      for (auto& m : std::exchange(shards[i], {})) sink(std::move(m));
+  });
+
+  // Merge in the order of 'files', the order a serial run visits them.
+  for (auto& shard : shards) merge_modules(modules, std::move(shard));
+  return *std::max_element(cbegin(status), cend(status));
+}
+
+void ffi::ffi_driver::merge_dependencies(module_contents& mod) const {
+  if (extra_dependencies.empty()) return;
+  auto& deps = mod.dependencies;
+  deps.insert(end(deps), begin(extra_dependencies), end(extra_dependencies));
+  std::sort(begin(deps), end(deps));
+  deps.erase(std::unique(begin(deps), end(deps)), end(deps));
+}
+
+void ffi::ffi_driver::add_dependencies(llvm::ArrayRef<std::string> files) {
+  for (const auto& f : files)
+    if (const auto p = modules.find(module_name_of(cfg, f));
+        p != modules.end())
+      merge_dependencies(p->second);
+}
+
+std::string ffi::ffi_driver::parse_key(
+    const clang::tooling::CompilationDatabase& compilations,
+    llvm::StringRef file) const {
+  llvm::SmallString<128> path{file};
+  llvm::sys::fs::make_absolute(path);
+  auto key = path.str().str();
+  llvm::raw_string_ostream os{key};
+  for (auto& cmd : compilations.getCompileCommands(path)) {
+    if (arguments_adjuster)
+      cmd.CommandLine = arguments_adjuster(cmd.CommandLine, cmd.Filename);
+    os << '\n' << cmd.Directory;
+    for (const auto& arg : cmd.CommandLine) os << '\0' << arg;
+  }
+  os << '\n'
+     << cfg.allow_custom_fixed_size_int << cfg.assume_extern_c
+     << cfg.warn_no_c_linkage << cfg.warn_no_external_formal_linkage
+     << cfg.generate_storable_instances
+     << is_header_group(cfg, module_name_of(cfg, path));
+  for (const auto* patterns :
+       {&cfg.unsafe_calls, &cfg.safe_calls, &cfg.pure_calls}) {
+    os << '\n';
+    for (const auto& p : *patterns) os << '\0' << p;
+  }
+  os.flush();
+  return fmt::format(FMT_STRING("{:016x}"), llvm::xxHash64(key));
 }
 
-ffi::info_collect_action::info_collect_action(config& cfg, module_list& modules)
-    : cfg{cfg}, modules{modules} {}
+int ffi::ffi_driver::run_unity(
+    const clang::tooling::CompilationDatabase& compilations,
+    llvm::ArrayRef<std::string> files) {
+  // One synthetic header including all the others, only in memory.
+  llvm::SmallString<128> unity_file{"auto-ffi-unity.h"};
+  llvm::sys::fs::make_absolute(unity_file);
+  std::vector<std::string> abs_files;
+  std::string contents;
+  for (const auto& f : files) {
+    llvm::SmallString<128> path{f};
+    llvm::sys::fs::make_absolute(path);
+    contents +=
+        fmt::format(FMT_STRING("#include \"{}\"\n"), path.str().str());
+    abs_files.emplace_back(path.str());
+  }
+
+  clang::tooling::ClangTool tool{compilations, unity_file.str().str()};
+  tool.mapVirtualFile(unity_file, contents);
+  if (arguments_adjuster) tool.appendArgumentsAdjuster(arguments_adjuster);
+  unity_consumer_factory consumers{cfg, types, modules, abs_files};
+  return tool.run(clang::tooling::newFrontendActionFactory(&consumers).get());
+}
+
+ffi::info_collect_factory::info_collect_factory(config& cfg, type_arena& types,
+                                                module_list& modules)
+    : cfg{cfg}, types{types}, modules{modules} {}
+
+clang::FrontendAction* ffi::info_collect_factory::create() {
+  return new info_collect_action{cfg, types, modules};
+}
+
+ffi::info_collect_action::info_collect_action(config& cfg, type_arena& types,
+                                              module_list& modules)
+    : cfg{cfg}, types{types}, modules{modules} {}
 
 std::unique_ptr<clang::ASTConsumer> ffi::info_collect_action::CreateASTConsumer(
     clang::CompilerInstance& compiler, llvm::StringRef in_file) {
-  llvm::SmallString<0> path{in_file.begin(), in_file.end()};
-  llvm::sys::path::replace_path_prefix(path, cfg.root_directory, "");
-  auto file = llvm::sys::path::relative_path(path.str()).str();
-  auto [p, inserted] = modules.try_emplace(file.data());
-  return std::make_unique<info_collector>(cfg, p->first, p->second);
+  auto [p, inserted] = modules.try_emplace(module_name_of(cfg, in_file));
+  return std::make_unique<info_collector>(cfg, types, p->first, p->second);
 }
 
-ffi::info_collector::info_collector(config& cfg, std::string_view file_name,
+ffi::info_collector::info_collector(config& cfg, type_arena& types,
+                                    std::string_view file_name,
                                     module_contents& current_module)
-    : cfg{cfg}, file_name{file_name}, current_module{current_module} {}
+    : cfg{cfg},
+      types{types},
+      file_name{file_name},
+      current_module{current_module} {}
 
 void ffi::info_collector::HandleTranslationUnit(clang::ASTContext& context) {
-  const auto is_hg = cfg.is_header_group.cend() !=
-                     std::find(cfg.is_header_group.cbegin(),
-                               cfg.is_header_group.cend(), file_name);
-  ast_visitor visitor{cfg, current_module, context, is_hg};
+  const auto& sm = context.getSourceManager();
+  owner_map owners;
+  owners.try_emplace(sm.getFileEntryForID(sm.getMainFileID()),
+                     module_owner{&current_module,
+                                  is_header_group(cfg, file_name)});
+  ast_visitor visitor{cfg, types, owners, context};
+  visitor.TraverseDecl(context.getTranslationUnitDecl());
+  spdlog::debug("'{}': {} type cache hits, {} misses.", file_name,
+                visitor.type_cache_hits(), visitor.type_cache_misses());
+  current_module.dependencies = source_files(sm);
+}
+
+ffi::unity_collector::unity_collector(config& cfg, type_arena& types,
+                                      module_list& modules,
+                                      llvm::ArrayRef<std::string> files)
+    : cfg{cfg}, types{types}, modules{modules}, files{files} {}
+
+void ffi::unity_collector::HandleTranslationUnit(clang::ASTContext& context) {
+  auto& fm = context.getSourceManager().getFileManager();
+  owner_map owners;
+  for (const auto& f : files) {
+#if LLVM_VERSION_MAJOR >= 10
+    const auto file = fm.getFile(f);
+    if (!file) continue;
+    const auto* entry = *file;
+#else
+    const auto* entry = fm.getFile(f);
+    if (!entry) continue;
+#endif
+    auto [p, inserted] = modules.try_emplace(module_name_of(cfg, f));
+    const auto is_hg = is_header_group(cfg, p->first);
+    owners.try_emplace(entry, module_owner{&p->second, is_hg});
+  }
+  ast_visitor visitor{cfg, types, owners, context};
   visitor.TraverseDecl(context.getTranslationUnitDecl());
+  spdlog::debug("unity build: {} type cache hits, {} misses.",
+                visitor.type_cache_hits(), visitor.type_cache_misses());
+  // Without knowing who includes whom, every module depends on everything.
+  const auto deps = source_files(context.getSourceManager());
+  for (const auto& p : owners) p.second.mod->dependencies = deps;
 }
@@ -17,43 +17,131 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <utility>
 
 #include <clang/AST/ASTConsumer.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 
 #include "config.h"
 #include "module.h"
+#include "type_arena.h"
 
 namespace ffi {
 using module_list = std::map<std::string, module_contents, std::less<>>;
 
+// A module to generate, an element of a module list.
+using module_ref = const std::pair<const std::string, module_contents>*;
+
+// Name of the module generated for 'file'.
+std::string module_name_of(const config& cfg, llvm::StringRef file);
+
+// Path to the JSON compilation database in 'cfg', empty if there is none.
+std::string compilation_database_file(const config& cfg);
+
+// Compile commands for 'cfg'. With a 'compilation_database', every file uses
+// its own command, and a file without one (e.g. a header) uses the command of
+// the file most like it, as 'clang::tooling::inferMissingCompileCommands'
+// decides; 'compiler_options' are appended to every command. Without one,
+// 'compiler_options' is the command for all files.
+// Returns nullptr and sets 'error' if the database fails to load.
+std::unique_ptr<clang::tooling::CompilationDatabase> make_compilations(
+    const config& cfg, std::string& error);
+
+// All the files on disk a translation unit opened, as sorted absolute paths.
+std::vector<std::string> source_files(const clang::SourceManager& sm);
+
+// Merge 'from' into 'to'. Existing declarations in 'to' take precedence, the
+// same as if both were collected by a single front-end action.
+void merge_modules(module_list& to, module_list&& from);
+
 struct ffi_driver final : clang::tooling::FrontendActionFactory {
   clang::FrontendAction* create() override;
+  // Run the front-end on 'files', with at most 'jobs' translation units in
+  // flight. The result is the same as a serial run, whatever 'jobs' is.
+  int run(const clang::tooling::CompilationDatabase& compilations,
+          llvm::ArrayRef<std::string> files, unsigned jobs = 1);
+  // Everything the module of 'file' depends on besides the files it opens:
+  // the compile command, and the options the front-end reads from 'cfg'.
+  // Modules with the same key are the same, whichever driver parses them,
+  // unless it is a 'unity_build'.
+  std::string parse_key(const clang::tooling::CompilationDatabase& compilations,
+                        llvm::StringRef file) const;
   config cfg;
+  // All the types in 'modules', it should outlive them.
+  type_arena types;
   module_list modules;
+  // Parse all of 'files' in a single translation unit, see 'unity_build'.
+  int run_unity(const clang::tooling::CompilationDatabase& compilations,
+                llvm::ArrayRef<std::string> files);
+  // Add 'extra_dependencies' to a module, or to the modules of 'files'.
+  void merge_dependencies(module_contents& mod) const;
+  void add_dependencies(llvm::ArrayRef<std::string> files);
+  // Extra adjustment to every command line, e.g. to inject a prelude PCH.
+  clang::tooling::ArgumentsAdjuster arguments_adjuster{};
+  // If set, every module goes here instead of 'modules', as soon as its
+  // translation unit is parsed without errors, on the thread parsing it.
+  // Unity builds hand all the modules over at the end.
+  std::function<void(cmodule)> sink{};
+  // Files every module parsed depends on besides those Clang opens for it,
+  // e.g. the inputs of a precompiled prelude.
+  std::vector<std::string> extra_dependencies{};
+};
+
+class info_collect_factory final
+    : public clang::tooling::FrontendActionFactory {
+ public:
+  info_collect_factory(config& cfg, type_arena& types, module_list& modules);
+  clang::FrontendAction* create() override;
+
+ private:
+  config& cfg;
+  type_arena& types;
+  module_list& modules;
 };
 
 class info_collect_action final : public clang::ASTFrontendAction {
  public:
-  info_collect_action(config& cfg, module_list& modules);
+  info_collect_action(config& cfg, type_arena& types, module_list& modules);
   std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
       clang::CompilerInstance& compiler, llvm::StringRef in_file) override;
 
  private:
   config& cfg;
+  type_arena& types;
   module_list& modules;
 };
 
 class info_collector final : public clang::ASTConsumer {
  public:
-  info_collector(config& cfg, std::string_view file_name,
+  info_collector(config& cfg, type_arena& types, std::string_view file_name,
                  module_contents& current_module);
   void HandleTranslationUnit(clang::ASTContext& context) override;
 
  private:
   config& cfg;
+  type_arena& types;
   std::string_view file_name;
   module_contents& current_module;
 };
+
+// Collects a unity translation unit, where every file in 'files' is included
+// by a synthetic main file. A declaration goes to the module of the file it
+// is defined in.
+class unity_collector final : public clang::ASTConsumer {
+ public:
+  unity_collector(config& cfg, type_arena& types, module_list& modules,
+                  llvm::ArrayRef<std::string> files);
+  void HandleTranslationUnit(clang::ASTContext& context) override;
+
+ private:
+  config& cfg;
+  type_arena& types;
+  module_list& modules;
+  llvm::ArrayRef<std::string> files;
+};
 }  // namespace ffi
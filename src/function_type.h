@@ -17,16 +17,15 @@
 
 #pragma once
 
-#include <memory>
-#include <string>
+#include <string_view>
 #include <vector>
 
 namespace ffi {
 struct ctype;
-using entity = std::pair<std::string, ctype>;
+using entity = std::pair<std::string_view, const ctype*>;
 
 struct function_type {
-  std::unique_ptr<ctype> return_type{};
+  const ctype* return_type{};
   std::vector<entity> params{};
 };
 }  // namespace ffi
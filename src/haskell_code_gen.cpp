@@ -17,41 +17,37 @@
 
 #include "haskell_code_gen.h"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
 #include <fmt/format.h>
 #include <gsl/gsl_assert>
 #include <inja/inja.hpp>
 
+#include "compiled_template.h"
+#include "compiled_templates.h"
 #include "inja_callback.h"
 #include "json.h"
-#include "templates.h"
+#include "parallel.h"
 
 namespace {
 constexpr size_t npos = std::numeric_limits<size_t>::max();
-}  // namespace
 
-void ffi::haskell_code_gen::gen_module(const std::string& name,
-                                       const module_contents& mod) {
-  // Set up name converters
-  if (auto p = cfg.file_name_converters.find(name);
-      p != cfg.file_name_converters.cend())
-    cfg.name_converters.for_all.forward_converter = &p->second;
-  else
-    cfg.name_converters.for_all.forward_converter = nullptr;
-  resolver = &cfg.explicit_name_mapping[name];
+// Guards 'module_name_mapping' and 'rev_modules' in all configurations.
+std::mutex module_names_mutex;
+}  // namespace
 
-  // Locate output file
-  auto mname = cfg.name_converters.for_module.convert(name);
-  auto parent_dir = format(FMT_STRING("{}/{}/LowLevel"), cfg.output_directory,
-                           cfg.library_name);
-  auto mod_file = format(FMT_STRING("{}/{}.hs"), parent_dir, mname);
-  llvm::sys::fs::create_directories(parent_dir);
-  std::ofstream ofs{mod_file, std::ios::out};
-  if (!ofs) return spdlog::error("Cannot open file '{}'.\n", mod_file);
+ffi::haskell_code_gen::haskell_code_gen(config& cfg)
+    : cfg{cfg}, converters{cfg.name_converters} {
+  load_template();
+}
 
-  // Generate module
-  inja::Environment env;
+void ffi::haskell_code_gen::load_template() {
   add_callback(env, "gen_type",
                [this](ctype_ref t) { return gen_type(*t.pointee); });
+  add_callback(env, "gen_pure_type",
+               [this](ctype_ref t) { return gen_pure_type(*t.pointee); });
   add_callback(env, "gen_name", [this](name_variant v, std::string_view n) {
     return gen_name(v, n);
   });
@@ -71,26 +67,221 @@ void ffi::haskell_code_gen::gen_module(const std::string& name,
                [this](std::string_view n, std::string_view scope) {
                  return gen_name(name_variant::variable, n, scope);
                });
+  // Templates compiled into this build go without Inja.
+  if (!cfg.compiled_template.empty()) {
+    const auto p = std::find_if(
+        compiled_templates.cbegin(), compiled_templates.cend(),
+        [this](const auto& t) { return t.name == cfg.compiled_template; });
+    if (p == compiled_templates.cend())
+      return spdlog::error("No compiled template named '{}' in this build.",
+                           cfg.compiled_template);
+    compiled = &*p;
+    template_valid = true;
+    return;
+  }
+  // The default template has a native implementation.
+  if (cfg.custom_template.empty()) {
+    template_valid = true;
+    return;
+  }
   try {
-    auto output_template = [this, &env] {
-      if (!cfg.custom_template.empty()) {
-        env.set_trim_blocks(cfg.inja_set_trim_blocks);
-        env.set_lstrip_blocks(cfg.inja_set_lstrip_blocks);
-        return env.parse_template(cfg.custom_template);
-      } else {
-        env.set_trim_blocks(true);
-        return env.parse(default_template_hs);
-      }
-    }();
-    auto data = nlohmann::json::object({{"module", mod}, {"cfg", cfg}});
-    data["module"]["name"] = name;
-    spdlog::trace("JSON data for template output:\n{}\n", data.dump(2));
-    env.render_to(ofs, output_template, data);
+    env.set_trim_blocks(cfg.inja_set_trim_blocks);
+    env.set_lstrip_blocks(cfg.inja_set_lstrip_blocks);
+    output_template = env.parse_template(cfg.custom_template);
+    template_valid = true;
   } catch (const std::runtime_error& e) {
     spdlog::error(e.what());
   }
 }
 
+ffi::write_status ffi::haskell_code_gen::gen_module(
+    const std::string& name, const module_contents& mod) {
+  Expects(template_valid);
+  // Locate output file
+  const auto mod_file = module_file(name);
+
+  // Generate module
+  std::string buffer;
+  llvm::raw_string_ostream os{buffer};
+  if (compiled) {
+    tpl::context ctx{*this, cfg, os};
+    compiled->render(ctx, tpl::make_module(name, mod));
+  } else if (cfg.custom_template.empty()) {
+    gen_default_module(os, name, mod);
+  } else {
+    try {
+      auto data = nlohmann::json::object({{"module", mod}, {"cfg", cfg}});
+      data["module"]["name"] = name;
+      spdlog::trace("JSON data for template output:\n{}\n", data.dump(2));
+      os << env.render(output_template, data);
+    } catch (const std::runtime_error& e) {
+      spdlog::error(e.what());
+      return write_status::failed;
+    }
+  }
+  os.flush();
+
+  // Write to the output file, only if it changes
+  llvm::sys::fs::create_directories(lowlevel_directory());
+  const auto status = write_if_changed(mod_file, buffer);
+  if (status == write_status::failed)
+    spdlog::error("Cannot write file '{}'.\n", mod_file);
+  return status;
+}
+
+void ffi::haskell_code_gen::gen_default_module(llvm::raw_ostream& os,
+                                               const std::string& name,
+                                               const module_contents& mod) {
+  // This follows default_template.hs line by line, and resolves names in the
+  // same order, so that name clashes are also reported the same.
+  const auto gen = [this](name_variant v, std::string_view n,
+                          std::string_view scope = {}) {
+    const auto res = gen_name(v, n, scope);
+    return llvm::StringRef{res.data(), res.size()};
+  };
+  const auto join = [&os](llvm::StringRef prefix,
+                          const std::vector<std::string>& types) {
+    for (size_t i = 0; i < types.size(); ++i)
+      os << (i == 0 ? "" : ", ") << prefix << " (undefined :: " << types[i]
+         << ")";
+  };
+  constexpr auto let_size =
+      "    let sizeAlign x = (sizeOf x, alignment x)\n"
+      "        makeSize = foldl' (\\sz (sx, ax) -> alignTo sz ax + sx) 0\n"
+      "        alignTo s a = ((s + a - 1) `quot` a) * a\n";
+
+  os << "{-# LANGUAGE EmptyDataDecls #-}\n"
+        "{-# LANGUAGE ForeignFunctionInterface #-}\n"
+        "{-# LANGUAGE PatternSynonyms #-}\n"
+        "{-# LANGUAGE GeneralizedNewtypeDeriving #-}\n"
+        "{-# LANGUAGE DerivingStrategies #-}\n"
+        "{-# OPTIONS_GHC -Wno-missing-pattern-synonym-signatures #-}\n"
+        "{-# OPTIONS_GHC -Wno-unused-imports #-}\n"
+        "module "
+     << gen(name_variant::module_name, name)
+     << " where\n"
+        "\n"
+        "import Foreign.C.Types\n"
+        "import Foreign.C.String\n"
+        "import Foreign.Storable\n"
+        "import Foreign.Ptr\n"
+        "import Foreign.Marshal.Alloc\n"
+        "\n"
+        "import Data.Int\n"
+        "import Data.Word\n"
+        "import Data.List\n"
+        "\n";
+  for (const auto& imp : mod.imports) os << "import " << imp << '\n';
+  os << '\n';
+
+  std::vector<std::string> types;
+  for (const auto& [s, tag] : mod.tags) {
+    const auto record = std::get_if<structure>(&tag.payload);
+    if (!record) continue;
+    os << "data " << gen(name_variant::type_ctor, s) << " = "
+       << gen(name_variant::data_ctor, s) << '\n';
+    types.clear();
+    for (const auto& [field, type] : record->fields) {
+      os << (types.empty() ? "  { " : "  , ")
+         << gen(name_variant::variable, field, s) << " :: ";
+      types.push_back(gen_type(*type));
+      os << types.back() << '\n';
+    }
+    if (!types.empty()) os << "  }\n";
+    if (!cfg.generate_storable_instances) continue;
+    os << "instance Storable " << gen(name_variant::type_ctor, s)
+       << " where\n";
+    if (const auto& layout = record->layout) {
+      os << "  sizeOf _ = " << layout->size << "\n  alignment _ = "
+         << layout->alignment << "\n  peek _p'0 = "
+         << (types.empty() ? "pure " : "") << gen(name_variant::data_ctor, s)
+         << '\n';
+      for (size_t i = 0; i < types.size(); ++i)
+        os << (i == 0 ? "    <$>" : "    <*>") << " peekByteOff _p'0 "
+           << layout->offsets[i] << '\n';
+      os << "  poke _p'0 _r'0 = do\n";
+      size_t i = 0;
+      for (const auto& field : record->fields)
+        os << "    pokeByteOff _p'0 " << layout->offsets[i++] << " ("
+           << gen(name_variant::variable, field.first, s) << " _r'0)\n";
+      os << "    pure ()\n";
+      continue;
+    }
+    os << "  sizeOf _ =\n" << let_size << "    in makeSize [";
+    join("sizeAlign", types);
+    os << "]\n  alignment _ = maximum [";
+    join("alignment", types);
+    os << "]\n  peek _p'0 =\n"
+       << let_size << "        offsets = map makeSize $ inits [";
+    join("sizeAlign", types);
+    os << "]\n    in " << gen(name_variant::data_ctor, s) << '\n';
+    for (size_t i = 0; i < types.size(); ++i)
+      os << (i == 0 ? "    <$>" : "    <*>") << " peekByteOff _p'0 (offsets !! "
+         << i << ")\n";
+    os << "  poke _p'0 _r'0 =\n"
+       << let_size << "        offsets = map makeSize $ inits [";
+    join("sizeAlign", types);
+    os << "]\n    in do\n";
+    size_t i = 0;
+    for (const auto& field : record->fields)
+      os << "    pokeByteOff _p'0 (offsets !! " << i++ << ") ("
+         << gen(name_variant::variable, field.first, s) << " _r'0)\n";
+  }
+  os << '\n';
+
+  for (const auto& [e, tag] : mod.tags) {
+    const auto enm = std::get_if<enumeration>(&tag.payload);
+    if (!enm) continue;
+    os << "newtype " << gen(name_variant::type_ctor, e) << " = "
+       << gen(name_variant::data_ctor, e) << "{ unwrap"
+       << gen(name_variant::data_ctor, e)
+       << " :: " << gen_type(*enm->underlying_type) << " }\n";
+    if (cfg.generate_storable_instances) os << "  deriving (Storable)\n";
+    for (const auto& [item, value] : enm->values)
+      os << "pattern " << gen(name_variant::type_ctor, item) << " = "
+         << gen(name_variant::data_ctor, e) << ' ' << value << '\n';
+  }
+  os << '\n';
+
+  for (const auto& [v, info] : mod.entities)
+    os << "foreign import ccall " << (info.unsafe ? "unsafe \"" : "\"") << v
+       << "\" " << gen(name_variant::variable, v)
+       << " :: "
+       << (info.pure ? gen_pure_type(*info.type) : gen_type(*info.type))
+       << '\n';
+}
+
+std::string ffi::haskell_code_gen::module_file(const std::string& name) {
+  enter_module(name);
+  const auto& mname = convert(converters.for_module, name);
+  return format(FMT_STRING("{}/{}.hs"), lowlevel_directory(), mname);
+}
+
+void ffi::haskell_code_gen::declare_module(const std::string& name) {
+  enter_module(name);
+  name_resolve(name_variant::module_name, {{}, name});
+}
+
+void ffi::haskell_code_gen::enter_module(const std::string& name) {
+  // Set up name converters
+  if (auto p = cfg.file_name_converters.find(name);
+      p != cfg.file_name_converters.cend())
+    converters.for_all.forward_converter = &p->second;
+  else
+    converters.for_all.forward_converter = nullptr;
+  // Only insert if not declared, lookups are safe to run concurrently.
+  if (auto p = cfg.explicit_name_mapping.find(name);
+      p != cfg.explicit_name_mapping.end())
+    resolver = &p->second;
+  else
+    resolver = &cfg.explicit_name_mapping[name];
+}
+
+std::string ffi::haskell_code_gen::lowlevel_directory() const {
+  return format(FMT_STRING("{}/{}/LowLevel"), cfg.output_directory,
+                cfg.library_name);
+}
+
 std::string_view ffi::haskell_code_gen::gen_name(name_variant v,
                                                  std::string_view name,
                                                  std::string_view scope) {
@@ -104,6 +295,15 @@ std::string ffi::haskell_code_gen::gen_type(const ctype& type) {
   return result;
 }
 
+std::string ffi::haskell_code_gen::gen_pure_type(const ctype& type) {
+  const auto func = std::get_if<function_type>(&type.value);
+  if (!func) return gen_type(type);
+  std::string result;
+  llvm::raw_string_ostream stream{result};
+  gen_function_type(stream, *func, true);
+  return stream.str();
+}
+
 void ffi::haskell_code_gen::gen_type(llvm::raw_ostream& os, const ctype& type,
                                      bool paren) {
   const auto idx = type.value.index();
@@ -120,13 +320,14 @@ void ffi::haskell_code_gen::gen_type(llvm::raw_ostream& os, const ctype& type,
 }
 
 void ffi::haskell_code_gen::gen_function_type(llvm::raw_ostream& os,
-                                              const function_type& func) {
+                                              const function_type& func,
+                                              bool pure) {
   for (const auto& tp : func.params) {
-    gen_type(os, tp.second);
+    gen_type(os, *tp.second);
     os << " -> ";
   }
-  os << "IO ";
-  gen_type(os, *func.return_type, true);
+  if (!pure) os << "IO ";
+  gen_type(os, *func.return_type, !pure);
 }
 
 void ffi::haskell_code_gen::gen_scalar_type(llvm::raw_ostream& os,
@@ -196,10 +397,10 @@ std::string_view ffi::haskell_code_gen::name_resolve(name_variant v,
   const auto nv = static_cast<size_t>(v) - 1;
   Expects(0 <= nv && nv < 4);
   auto& conv = *std::array{
-      &cfg.name_converters.for_var,
-      &cfg.name_converters.for_module,
-      &cfg.name_converters.for_type,
-      &cfg.name_converters.for_ctor,
+      &converters.for_var,
+      &converters.for_module,
+      &converters.for_type,
+      &converters.for_ctor,
   }[nv];
   auto& fwd = *std::array{
       &resolver->variables,
@@ -213,9 +414,40 @@ std::string_view ffi::haskell_code_gen::name_resolve(name_variant v,
       &resolver->rev_type_ctors,
       &resolver->rev_data_ctors,
   }[nv];
-  if (const auto p = fwd.find(n); p != fwd.cend()) return p->second;
-  auto [p, _] = fwd.emplace(n.materialize(), conv.convert(n.name));
-  rev.emplace(p->second, p->first);
-  spdlog::trace("name '{}' get converted to '{}'.", n, p->second);
+  std::unique_lock<std::mutex> lock{module_names_mutex, std::defer_lock};
+  if (v == name_variant::module_name) lock.lock();
+  if (const auto p = fwd.find(n)) return *p;
+  const auto e = fwd.try_emplace(n, convert(conv, n.name)).first;
+  if (rev.insert(e->value, e->key())) ++clashes_found;
+  spdlog::trace("name '{}' get converted to '{}'.", n, e->value);
+  return e->value;
+}
+
+const std::string& ffi::haskell_code_gen::convert(const name_converter& conv,
+                                                  std::string_view name) const {
+  auto& memo = converted[{&conv, converters.for_all.forward_converter}];
+  auto [p, inserted] = memo.try_emplace({name.data(), name.size()});
+  if (inserted) {
+    p->second.assign(name);
+    conv.convert_in_place(p->second);
+  }
   return p->second;
 }
+
+std::vector<std::optional<ffi::write_status>> ffi::gen_modules(
+    haskell_code_gen& code_gen, config& cfg,
+    llvm::ArrayRef<module_ref> modules, unsigned jobs) {
+  std::vector<std::optional<write_status>> res(modules.size());
+  // Clashes within a module do not stop the others, so that the same modules
+  // are generated whatever the order or the number of threads.
+  if (code_gen.clashes() != 0) return res;
+  std::vector<std::unique_ptr<haskell_code_gen>> workers(jobs);
+  parallel_for(jobs, modules.size(), [&](unsigned w, size_t i) {
+    auto& gen = w == 0 ? code_gen : [&]() -> haskell_code_gen& {
+      if (!workers[w]) workers[w] = std::make_unique<haskell_code_gen>(cfg);
+      return *workers[w];
+    }();
+    res[i] = gen.gen_module(modules[i]->first, modules[i]->second);
+  });
+  return res;
+}
@@ -17,26 +17,65 @@
 
 #pragma once
 
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <inja/inja.hpp>
+
 #include "config.h"
 #include "module.h"
+#include "output_file.h"
 
 namespace ffi {
+namespace tpl {
+struct compiled_template;
+}  // namespace tpl
+
 class haskell_code_gen {
  public:
-  explicit haskell_code_gen(config& cfg) : cfg{cfg} {}
+  // Parse the output template, see 'valid'.
+  explicit haskell_code_gen(config& cfg);
+  // Callbacks in the environment refer to this instance.
+  haskell_code_gen(const haskell_code_gen&) = delete;
+  haskell_code_gen& operator=(const haskell_code_gen&) = delete;
+
+  // Whether the output template is parsed, errors are already reported.
+  [[nodiscard]] bool valid() const { return template_valid; }
+  // Number of name clashes found by this instance, see 'name_clashes'.
+  [[nodiscard]] size_t clashes() const { return clashes_found; }
 
-  void gen_module(const std::string& name, const module_contents& mod);
+  // Render module 'name' in memory, and write it unless it is unchanged.
+  write_status gen_module(const std::string& name, const module_contents& mod);
+  // Path to the Haskell source generated for module 'name'.
+  // Module names are shared by all instances on the same configuration, and
+  // every other name belongs to a module: instances may generate different
+  // modules concurrently, if all modules are declared beforehand.
+  std::string module_file(const std::string& name);
+  // Take note of the name of a module not generated in this run, so that
+  // clashes with it are still reported.
+  void declare_module(const std::string& name);
 
   std::string_view gen_name(name_variant v, std::string_view name,
                             std::string_view scope = {});
 
   std::string gen_type(const ctype& type);
+  // Function types without 'IO' on the result, other types as 'gen_type'.
+  std::string gen_pure_type(const ctype& type);
 
  protected:
+  // What 'default_template_hs' renders to, without going through JSON.
+  void gen_default_module(llvm::raw_ostream& os, const std::string& name,
+                          const module_contents& mod);
+
   void gen_type(llvm::raw_ostream& os, const ctype& type, bool paren = false);
-  void gen_function_type(llvm::raw_ostream& os, const function_type& func);
+  void gen_function_type(llvm::raw_ostream& os, const function_type& func,
+                         bool pure = false);
   void gen_scalar_type(llvm::raw_ostream& os, const scalar_type& scalar);
   void gen_opaque_type(llvm::raw_ostream& os, const opaque_type& opaque);
   void gen_pointer_type(llvm::raw_ostream& os, const pointer_type& pointer);
@@ -49,9 +88,35 @@ class haskell_code_gen {
   static bool is_function(const ctype& type);
 
   std::string_view name_resolve(name_variant v, scoped_name_view n) const;
+  // Memoized 'conv.convert(name)' in the current module.
+  const std::string& convert(const name_converter& conv,
+                             std::string_view name) const;
+
+  void enter_module(const std::string& name);
+  std::string lowlevel_directory() const;
 
  private:
+  void load_template();
+
   config& cfg;
+  name_converter_bundle converters;
   name_resolver* resolver{nullptr};
+  // By converter and the converter for the current file.
+  using converter_key = std::pair<const name_converter*, const name_converter*>;
+  mutable llvm::DenseMap<converter_key, llvm::StringMap<std::string>> converted;
+  mutable size_t clashes_found{0};
+  inja::Environment env;
+  inja::Template output_template;
+  const tpl::compiled_template* compiled{nullptr};
+  bool template_valid{false};
 };
+
+// Generate 'modules' on at most 'jobs' threads. Worker 0 uses 'code_gen', and
+// every other worker has a code generator of its own on 'cfg', see
+// haskell_code_gen::module_file. If 'code_gen' has found a clash already, i.e.
+// module names clash once all are declared, every module is skipped. Returns
+// what became of every module, std::nullopt for those skipped.
+std::vector<std::optional<write_status>> gen_modules(
+    haskell_code_gen& code_gen, config& cfg,
+    llvm::ArrayRef<module_ref> modules, unsigned jobs);
 }  // namespace ffi
@@ -32,19 +32,30 @@ void ffi::from_json(const nlohmann::json& j, config& cfg) {
 }
 
 void ffi::to_json(nlohmann::json& j, const module_contents& mod) {
-  j = nlohmann::json::object({
-      {"imports", mod.imports},
-      {"entities", mod.entities},
-  });
+  j = nlohmann::json::object({{"imports", mod.imports}});
+  auto& entities = j["entities"] = nlohmann::json::array();
+  for (const auto& [name, info] : mod.entities)
+    entities.push_back(nlohmann::json::object({
+        {"name", name},
+        {"type", tref(info.type)},
+        {"unsafe", info.unsafe},
+        {"pure", info.pure},
+    }));
   auto& structs = j["structs"] = nlohmann::json::array();
   auto& enums = j["enums"] = nlohmann::json::array();
   for (const auto& t : mod.tags)
-    if (std::holds_alternative<structure>(t.second.payload))
+    if (const auto s = std::get_if<structure>(&t.second.payload)) {
       structs.push_back(nlohmann::json::object({
           {"name", t.first},
-          {"fields", std::get<structure>(t.second.payload)},
+          {"fields", *s},
+          {"has_layout", s->layout.has_value()},
       }));
-    else {
+      auto& record = structs.back();
+      if (s->layout.has_value()) {
+        record["size"] = s->layout->size;
+        record["alignment"] = s->layout->alignment;
+      }
+    } else {
       const auto& enm = std::get<enumeration>(t.second.payload);
       enums.push_back(nlohmann::json::object({
           {"name", t.first},
@@ -56,14 +67,17 @@ void ffi::to_json(nlohmann::json& j, const module_contents& mod) {
 
 void ffi::to_json(nlohmann::json& j, const structure& tag) {
   j = nlohmann::json::array();
-  for (const auto& [name, type] : tag.fields)
+  for (size_t i = 0; i < tag.fields.size(); ++i) {
+    const auto& [name, type] = tag.fields[i];
     j.push_back(nlohmann::json::object({
         {"name", name},
         {"type", tref(type)},
     }));
+    if (tag.layout.has_value()) j.back()["offset"] = tag.layout->offsets[i];
+  }
 }
 
-void ffi::to_json(nlohmann::json& j, const_entity& val) {
+void ffi::to_json(nlohmann::json& j, const entity& val) {
   j = nlohmann::json::object({
       {"name", val.first},
       {"type", tref(val.second)},
@@ -28,12 +28,12 @@ void from_json(const nlohmann::json& j, config& cfg);
 void to_json(nlohmann::json& j, const module_contents& mod);
 
 void to_json(nlohmann::json& j, const structure& tag);
-void to_json(nlohmann::json& j, const_entity& val);
+void to_json(nlohmann::json& j, const entity& val);
 
 struct ctype_ref {
   const ctype* pointee;
 };
-inline ctype_ref tref(const ctype& t) { return ctype_ref{&t}; }
+inline ctype_ref tref(const ctype* t) { return ctype_ref{t}; }
 
 void to_json(nlohmann::json& j, const ctype_ref& t);
 void from_json(const nlohmann::json& j, ctype_ref& t);
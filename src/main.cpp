@@ -17,10 +17,15 @@
 
 #include <array>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include <clang/Frontend/TextDiagnosticPrinter.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/InitLLVM.h>
@@ -33,6 +38,11 @@
 #include "driver.h"
 #include "haskell_code_gen.h"
 #include "json.h"
+#include "manifest.h"
+#include "output_file.h"
+#include "parallel.h"
+#include "prelude.h"
+#include "server.h"
 #include "templates.h"
 #include "yaml.h"
 
@@ -51,6 +61,24 @@ cl::opt<bool> yaml{"yaml", cl::cat{category},
                    cl::desc{"Dump YAML for generated modules"}};
 cl::opt<bool> json{"json", cl::cat{category},
                    cl::desc{"Dump JSON for generated modules"}};
+cl::opt<unsigned> jobs{
+    "jobs", cl::cat{category}, cl::init(1), cl::value_desc{"N"},
+    cl::desc{"Parse and generate up to N modules in parallel (0: all cores)"}};
+cl::opt<bool> incremental{
+    "incremental", cl::cat{category},
+    cl::desc{"Only regenerate modules whose inputs changed since last run"}};
+cl::opt<std::string> depfile{
+    "depfile", cl::cat{category}, cl::value_desc{"path"},
+    cl::desc{"Write the files every module depends on as Makefile rules"}};
+cl::opt<std::string> depfile_target{
+    "depfile-target", cl::cat{category}, cl::value_desc{"path"},
+    cl::desc{"Target of the depfile rules, instead of every module file"}};
+cl::opt<std::string> serve{
+    "serve", cl::cat{category}, cl::value_desc{"socket"},
+    cl::desc{"Keep running, and generate on requests from a Unix socket"}};
+cl::opt<bool> watch{
+    "watch", cl::cat{category},
+    cl::desc{"Keep running, and regenerate modules as their inputs change"}};
 cl::opt<std::string> verbose{
     "verbose", cl::cat{category}, cl::init("info"), cl::value_desc{"level"},
     cl::desc{"Verbosity: [trace, debug, info, warning, error, critical, off]"}};
@@ -64,6 +92,62 @@ std::optional<spdlog::level::level_enum> parse_verbosity(std::string_view s) {
   return static_cast<spdlog::level::level_enum>(p - begin(levels));
 }
 
+// Escape a path for a Makefile rule, as Clang does for '-MD'.
+void print_make_path(llvm::raw_ostream& os, llvm::StringRef path) {
+  for (size_t i = 0; i < path.size(); ++i) {
+    if (path[i] == ' ' || path[i] == '#') {
+      // Backslashes before a space or a hash are escaped as well.
+      for (size_t j = i; j-- > 0 && path[j] == '\\';) os << '\\';
+      os << '\\';
+    } else if (path[i] == '$') {
+      os << '$';
+    }
+    os << path[i];
+  }
+}
+
+// Make rules for the module files of 'cfg_file': the modules in 'driver', and
+// those in 'manifest' not generated again. Paths are absolute, except for
+// '--depfile-target', which is the target of every rule if it is given.
+void print_make_rules(llvm::raw_ostream& os, ffi::ffi_driver& driver,
+                      const ffi::manifest& manifest,
+                      ffi::haskell_code_gen& code_gen,
+                      llvm::StringRef cfg_file) {
+  std::vector<std::string> common{cfg_file.str()};
+  for (const auto& f : {driver.cfg.custom_template,
+                        ffi::compilation_database_file(driver.cfg)})
+    if (!f.empty()) {
+      llvm::SmallString<128> path{f};
+      llvm::sys::fs::make_absolute(path);
+      common.push_back(path.str().str());
+    }
+  for (const auto& f : driver.cfg.file_names) {
+    const auto name = ffi::module_name_of(driver.cfg, f);
+    const std::vector<std::string>* deps{};
+    if (const auto p = driver.modules.find(name); p != driver.modules.end())
+      deps = &p->second.dependencies;
+    else if (const auto q = manifest.modules.find(name);
+             q != manifest.modules.end())
+      deps = &q->second.dependencies;
+    if (!deps) continue;
+    llvm::SmallString<128> output{code_gen.module_file(name)};
+    llvm::sys::fs::make_absolute(output);
+    print_make_path(os, depfile_target.empty()
+                            ? output.str()
+                            : llvm::StringRef{depfile_target.getValue()});
+    os << ':';
+    // A missing prerequisite stops make, and makes ninja always rebuild.
+    const auto print_dep = [&os](llvm::StringRef dep) {
+      if (!llvm::sys::fs::exists(dep)) return;
+      os << " \\\n  ";
+      print_make_path(os, dep);
+    };
+    for (const auto& dep : common) print_dep(dep);
+    for (const auto& dep : *deps) print_dep(dep);
+    os << '\n';
+  }
+}
+
 const char version[]{
     "auto-FFI 2020\n"
     "Copyright (C) 2020 Xie Ruifeng.\n"
@@ -91,16 +175,15 @@ int main(int argc, const char* argv[]) {
     return 0;
   }
 
-  set_default_logger(spdlog::stderr_color_st("auto-ffi"));
+  set_default_logger(spdlog::stderr_color_mt("auto-ffi"));
   spdlog::set_pattern("%n: %^%l:%$ %v");
   if (const auto v = parse_verbosity(verbose)) spdlog::set_level(*v);
 
-  ffi::ffi_driver driver;
-
   // Configurations
   if (dump_config) {
+    ffi::config cfg;
     llvm::yaml::Output output{llvm::outs()};
-    output << driver.cfg;
+    output << cfg;
     return 0;
   }
 
@@ -110,6 +193,20 @@ int main(int argc, const char* argv[]) {
     return 0;
   }
 
+  // Daemon mode, the <file>s are generated once on start
+  if (!serve.empty()) {
+    const std::vector<std::string> files{config_files.begin(),
+                                         config_files.end()};
+    return ffi::serve(serve.getValue(), files, ffi::effective_jobs(jobs));
+  }
+
+  // Watch mode, the <file>s are generated on every change
+  if (watch && !config_files.empty()) {
+    const std::vector<std::string> files{config_files.begin(),
+                                         config_files.end()};
+    return ffi::watch(files, ffi::effective_jobs(jobs));
+  }
+
   // No input, print help and exit
   if (config_files.empty()) {
     cl::PrintHelpMessage();
@@ -119,7 +216,19 @@ int main(int argc, const char* argv[]) {
   // error counter
   int total_errors{0};
 
-  // Run on config files
+  // Make rules for '--depfile', written after all the configuration files
+  std::string rules;
+  llvm::raw_string_ostream rules_os{rules};
+
+  // Load all the config files first, every one has a driver of its own.
+  // Modules parsed for one are shared with those after it (see
+  // 'ffi_driver::parse_key'), so all the drivers are kept to the end.
+  struct project_entry {
+    std::string cfg_file;
+    std::unique_ptr<ffi::ffi_driver> driver;
+    std::shared_ptr<spdlog::logger> logger;
+  };
+  std::vector<project_entry> project;
   for (const auto& cfg_file : config_files) {
     auto contents = llvm::MemoryBuffer::getFile(cfg_file);
     if (auto ec = contents.getError()) {
@@ -128,17 +237,29 @@ int main(int argc, const char* argv[]) {
           cfg_file, ec.message());
       continue;
     }
+    auto driver = std::make_unique<ffi::ffi_driver>();
     llvm::yaml::Input input{contents.get()->getBuffer()};
-    input >> driver.cfg;
+    input >> driver->cfg;
     if (input.error()) continue;
 
     auto logger = spdlog::stderr_color_st(cfg_file);
 
     // Diagnostics engine for configuration files
-    if (!validate_config(driver.cfg, *logger)) {
+    if (!validate_config(driver->cfg, *logger)) {
       ++total_errors;
       continue;
     }
+    project.push_back({cfg_file, std::move(driver), std::move(logger)});
+  }
+
+  // Modules parsed so far, by 'ffi_driver::parse_key'
+  llvm::StringMap<const ffi::module_contents*> parsed;
+
+  // Run on config files
+  for (const auto& [cfg_file, driver_ptr, logger] : project) {
+    auto& driver = *driver_ptr;
+    llvm::SmallString<128> cfg_path{cfg_file};
+    llvm::sys::fs::make_absolute(cfg_path);
 
     // Load CWD
     llvm::SmallString<128> current_path;
@@ -146,18 +267,145 @@ int main(int argc, const char* argv[]) {
     if (!driver.cfg.root_directory.empty())
       llvm::sys::fs::set_current_path(driver.cfg.root_directory);
 
+    // Output template, checked before any work is done
+    ffi::haskell_code_gen code_gen{driver.cfg};
+    if (!code_gen.valid()) {
+      ++total_errors;
+      llvm::sys::fs::set_current_path(current_path);
+      continue;
+    }
+
     // Compiler options
-    clang::tooling::FixedCompilationDatabase compilations{
-        driver.cfg.root_directory.empty() ? "." : driver.cfg.root_directory,
-        driver.cfg.compiler_options};
+    std::string db_error;
+    const auto compilations = ffi::make_compilations(driver.cfg, db_error);
+    if (!compilations) {
+      logger->error("Cannot load compilation database: {}", db_error);
+      ++total_errors;
+      llvm::sys::fs::set_current_path(current_path);
+      continue;
+    }
+
+    // Skip the modules which are up to date
+    ffi::manifest manifest;
+    ffi::fingerprinter fingerprint{
+        incremental ? ffi::context_fingerprint(driver.cfg) : ""};
+    auto files = driver.cfg.file_names;
+    if (incremental) {
+      manifest = ffi::load_manifest(driver.cfg);
+      files = ffi::stale_files(driver.cfg, manifest, fingerprint);
+      logger->debug("{} of {} modules are up to date.",
+                    driver.cfg.file_names.size() - files.size(),
+                    driver.cfg.file_names.size());
+    }
+
+    // Common headers, precompiled once for all the translation units
+    driver.arguments_adjuster = nullptr;
+    driver.extra_dependencies.clear();
+    if (auto prelude =
+            files.empty()
+                ? std::nullopt
+                : ffi::prepare_prelude(driver.cfg, *compilations, *logger)) {
+      driver.arguments_adjuster = clang::tooling::getInsertArgumentAdjuster(
+          {"-include-pch", prelude->pch},
+          clang::tooling::ArgumentInsertPosition::END);
+      driver.extra_dependencies = std::move(prelude->inputs);
+    }
 
-    clang::tooling::ClangTool tool{compilations, driver.cfg.file_names};
+    // Modules already parsed for another config file, with the same key
+    std::vector<std::pair<std::string, const ffi::module_contents*>> shared;
+    std::vector<std::string> keys;
+    if (!driver.cfg.unity_build) {
+      std::vector<std::string> own;
+      for (const auto& f : files) {
+        auto key = driver.parse_key(*compilations, f);
+        if (const auto p = parsed.find(key); p != parsed.end()) {
+          shared.emplace_back(ffi::module_name_of(driver.cfg, f), p->second);
+        } else {
+          own.push_back(f);
+          keys.push_back(std::move(key));
+        }
+      }
+      files = std::move(own);
+      logger->debug("{} modules are shared with other config files.",
+                    shared.size());
+    }
+
+    // Modules are generated as soon as they are parsed: the front-end hands
+    // them over to 'jobs' generating threads through a bounded queue, so that
+    // at most a few of them wait in memory. Generated modules only keep their
+    // dependencies, unless they are dumped or may be shared with later
+    // config files. Module names are global, declare them all first.
+    for (const auto& f : driver.cfg.file_names)
+      code_gen.declare_module(ffi::module_name_of(driver.cfg, f));
+    const bool keep = yaml || json || project.size() > 1;
+    // Module name clashes are all found by now, and stop every module from
+    // being generated. Other clashes are within a single module, and do not
+    // stop the others. All of them are reported once the queue drains, so
+    // the output depends neither on the order modules are parsed in, nor on
+    // the number of threads.
+    const bool clashed = code_gen.clashes() != 0;
+    struct generator {
+      std::unique_ptr<ffi::haskell_code_gen> code_gen{};
+      ffi::module_list done{};
+      std::array<size_t, 3> counts{};
+      std::set<std::string, std::less<>> failed{};
+    };
+    std::vector<generator> generators(ffi::effective_jobs(jobs));
+    ffi::bounded_queue<ffi::cmodule> ready{generators.size()};
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < generators.size(); ++w)
+      threads.emplace_back([&, w, keep, clashed] {
+        // Worker 0 uses 'code_gen', as in 'ffi::gen_modules'.
+        auto& g = generators[w];
+        if (w != 0 && !clashed)
+          g.code_gen = std::make_unique<ffi::haskell_code_gen>(driver.cfg);
+        auto* gen = w == 0 ? &code_gen : g.code_gen.get();
+        while (auto m = ready.pop()) {
+          if (!clashed) {
+            const auto res = gen->gen_module(m->first, m->second);
+            ++g.counts[static_cast<size_t>(res)];
+            if (res == ffi::write_status::failed) g.failed.insert(m->first);
+          }
+          if (!keep) {
+            auto deps = std::move(m->second.dependencies);
+            m->second = {};
+            m->second.dependencies = std::move(deps);
+          }
+          g.done.emplace(std::move(m->first), std::move(m->second));
+        }
+      });
+    driver.sink = [&ready](ffi::cmodule m) { ready.push(std::move(m)); };
+    for (const auto& [name, mod] : shared) ready.push({name, *mod});
+    const auto status =
+        files.empty()
+            ? 0
+            : driver.run(*compilations, files, ffi::effective_jobs(jobs));
+    ready.close();
+    for (auto& t : threads) t.join();
+    driver.sink = nullptr;
+    driver.modules.clear();
+    std::array<size_t, 3> counts{};
+    std::set<std::string, std::less<>> failed_modules;
+    for (auto& g : generators) {
+      driver.modules.merge(g.done);
+      for (size_t i = 0; i < counts.size(); ++i) counts[i] += g.counts[i];
+      failed_modules.merge(g.failed);
+    }
 
-    if (const auto status = tool.run(&driver)) {
+    const auto [written, unchanged, failed] = counts;
+    logger->info("{} modules written, {} unchanged.", written, unchanged);
+    if (failed) ++total_errors;
+    if (status) {
       logger->debug("Clang front-end fails with status {}.", status);
       ++total_errors;
+      llvm::sys::fs::set_current_path(current_path);
       continue;
     }
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (const auto p =
+              driver.modules.find(ffi::module_name_of(driver.cfg, files[i]));
+          p != driver.modules.end())
+        parsed.try_emplace(keys[i], &p->second);
 
     if (yaml) {
       llvm::yaml::Output output{llvm::outs()};
@@ -169,24 +417,36 @@ int main(int argc, const char* argv[]) {
       llvm::outs() << j.dump(2) << '\n';
     }
 
-    ffi::haskell_code_gen code_gen{driver.cfg};
-    for (auto& [name, mod] : driver.modules) code_gen.gen_module(name, mod);
-
-    int nc{0};
-    nc += ffi::name_clashes(driver.cfg.rev_modules, *logger, "module",
-                            "(global)");
-    for (auto [mod, m] : driver.cfg.explicit_name_mapping) {
-      nc += ffi::name_clashes(m.rev_variables, *logger, "variable", mod);
-      nc += ffi::name_clashes(m.rev_data_ctors, *logger, "data ctor", mod);
-      nc += ffi::name_clashes(m.rev_type_ctors, *logger, "type ctor", mod);
-    }
+    const auto nc = ffi::name_clashes(driver.cfg, *logger);
     logger->debug("Total name clash: {}.", nc);
     if (nc) ++total_errors;
 
+    if (incremental && !nc) {
+      // Modules which failed to be written are generated again next time.
+      std::vector<ffi::module_ref> generated;
+      for (const auto& m : driver.modules)
+        if (failed_modules.count(m.first) == 0) generated.push_back(&m);
+      auto updated = ffi::update_manifest(driver.cfg, generated, manifest,
+                                          code_gen, fingerprint);
+      if (!ffi::save_manifest(driver.cfg, updated))
+        logger->warn("Cannot write manifest '{}'.",
+                     ffi::manifest_path(driver.cfg));
+    }
+
+    if (!depfile.empty())
+      print_make_rules(rules_os, driver, manifest, code_gen, cfg_path);
+
     // Recover CWD
     llvm::sys::fs::set_current_path(current_path);
   }
 
+  if (!depfile.empty() &&
+      ffi::write_if_changed(depfile.getValue(), rules_os.str()) ==
+          ffi::write_status::failed) {
+    spdlog::error("Cannot write depfile '{}'.", depfile.getValue());
+    ++total_errors;
+  }
+
   spdlog::debug("Total errors: {}\n", total_errors);
   return total_errors;
 }
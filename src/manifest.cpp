@@ -0,0 +1,130 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "manifest.h"
+
+#include <clang/Basic/Version.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/xxhash.h>
+
+#include <fmt/format.h>
+
+#include "haskell_code_gen.h"
+#include "output_file.h"
+#include "templates.h"
+#include "yaml.h"
+
+std::string ffi::manifest_path(const config& cfg) {
+  return format(FMT_STRING("{}/manifest-{}.yaml"), cache_directory(cfg),
+                cfg.library_name);
+}
+
+ffi::manifest ffi::load_manifest(const config& cfg) {
+  manifest m;
+  auto contents = llvm::MemoryBuffer::getFile(manifest_path(cfg));
+  if (!contents) return m;
+  llvm::yaml::Input input{contents.get()->getBuffer()};
+  input >> m;
+  if (input.error()) return manifest{};
+  return m;
+}
+
+bool ffi::save_manifest(const config& cfg, manifest& m) {
+  std::string buffer;
+  llvm::raw_string_ostream os{buffer};
+  llvm::yaml::Output output{os};
+  output << m;
+  os.flush();
+  llvm::sys::fs::create_directories(cache_directory(cfg));
+  return write_if_changed(manifest_path(cfg), buffer) != write_status::failed;
+}
+
+std::string ffi::context_fingerprint(config& cfg) {
+  std::string context = clang::getClangFullVersion();
+  llvm::raw_string_ostream os{context};
+  {
+    llvm::yaml::Output output{os};
+    output << cfg;
+  }
+  os << '\0';
+  if (cfg.custom_template.empty())
+    os << default_template_hs;
+  else if (auto t = llvm::MemoryBuffer::getFile(cfg.custom_template))
+    os << t.get()->getBuffer();
+  if (auto db = llvm::MemoryBuffer::getFile(compilation_database_file(cfg)))
+    os << '\0' << db.get()->getBuffer();
+  os.flush();
+  return format(FMT_STRING("{:016x}"), llvm::xxHash64(context));
+}
+
+std::optional<uint64_t> ffi::fingerprinter::hash_file(const std::string& file) {
+  auto [p, inserted] = hashes.try_emplace(file);
+  if (inserted)
+    if (auto contents = llvm::MemoryBuffer::getFile(file))
+      p->second = llvm::xxHash64(contents.get()->getBuffer());
+  return p->second;
+}
+
+std::optional<std::string> ffi::fingerprinter::operator()(
+    llvm::ArrayRef<std::string> deps) {
+  // A module depends on at least its main file, unless it failed to parse.
+  if (deps.empty()) return std::nullopt;
+  auto key = context;
+  for (const auto& d : deps) {
+    const auto h = hash_file(d);
+    if (!h.has_value()) return std::nullopt;
+    key.append(1, '\0').append(d).append(fmt::format("{:016x}", *h));
+  }
+  return format(FMT_STRING("{:016x}"), llvm::xxHash64(key));
+}
+
+std::vector<std::string> ffi::stale_files(const config& cfg, const manifest& m,
+                                          fingerprinter& fp) {
+  std::vector<std::string> res;
+  for (const auto& f : cfg.file_names) {
+    const auto p = m.modules.find(module_name_of(cfg, f));
+    if (p == m.modules.cend() || !llvm::sys::fs::exists(p->second.output) ||
+        fp(p->second.dependencies) != p->second.fingerprint)
+      res.push_back(f);
+  }
+  // A unity build parses all files or none.
+  if (cfg.unity_build && !res.empty()) return cfg.file_names;
+  return res;
+}
+
+ffi::manifest ffi::update_manifest(const config& cfg,
+                                   llvm::ArrayRef<module_ref> modules,
+                                   const manifest& old,
+                                   haskell_code_gen& code_gen,
+                                   fingerprinter& fp) {
+  llvm::StringMap<module_ref> recorded;
+  for (const auto m : modules) recorded.try_emplace(m->first, m);
+  manifest res;
+  for (const auto& f : cfg.file_names) {
+    auto name = module_name_of(cfg, f);
+    if (const auto p = recorded.find(name); p != recorded.end()) {
+      auto& entry = res.modules[name];
+      entry.output = code_gen.module_file(name);
+      entry.dependencies = p->second->second.dependencies;
+      entry.fingerprint = fp(entry.dependencies).value_or("");
+    } else if (const auto q = old.modules.find(name); q != old.modules.end()) {
+      res.modules.insert(*q);
+    }
+  }
+  return res;
+}
@@ -0,0 +1,78 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+
+#include "config.h"
+#include "driver.h"
+
+namespace ffi {
+class haskell_code_gen;
+
+// What a module was generated from last time.
+struct manifest_entry {
+  std::string fingerprint{};
+  std::string output{};
+  std::vector<std::string> dependencies{};
+};
+
+struct manifest {
+  std::map<std::string, manifest_entry, std::less<>> modules{};
+};
+
+std::string manifest_path(const config& cfg);
+manifest load_manifest(const config& cfg);
+bool save_manifest(const config& cfg, manifest& m);
+
+// Fingerprint of everything all modules depend on: the Clang version, the
+// effective configuration, the template, and the compilation database.
+std::string context_fingerprint(config& cfg);
+
+// Fingerprints of modules, from the context and the contents of the files
+// they depend on. File contents are hashed at most once per instance.
+class fingerprinter {
+ public:
+  explicit fingerprinter(std::string context) : context{std::move(context)} {}
+
+  // std::nullopt if some dependency cannot be read.
+  std::optional<std::string> operator()(llvm::ArrayRef<std::string> deps);
+
+ private:
+  std::optional<uint64_t> hash_file(const std::string& file);
+
+  std::string context;
+  llvm::StringMap<std::optional<uint64_t>> hashes;
+};
+
+// Files in 'cfg.file_names' whose modules are not up to date in 'm'.
+std::vector<std::string> stale_files(const config& cfg, const manifest& m,
+                                     fingerprinter& fp);
+
+// Record the modules in 'modules', and keep the other entries in 'old'. Pass
+// only the modules generated successfully, the others are still out of date.
+manifest update_manifest(const config& cfg, llvm::ArrayRef<module_ref> modules,
+                         const manifest& old, haskell_code_gen& code_gen,
+                         fingerprinter& fp);
+}  // namespace ffi
@@ -25,10 +25,21 @@
 #include "types.h"
 
 namespace ffi {
+// A function or variable to import.
+struct entity_info {
+  const ctype* type{};
+  // Import with 'ccall unsafe': the function never calls back into Haskell.
+  bool unsafe{false};
+  // Import without 'IO': the result depends on nothing but the arguments.
+  bool pure{false};
+};
+
 struct module_contents {
-  std::map<std::string, ctype, std::less<>> entities{};
+  std::map<std::string, entity_info, std::less<>> entities{};
   std::map<std::string, tag_type, std::less<>> tags{};
   std::vector<std::string> imports{};
+  // internal, files the module is parsed from
+  std::vector<std::string> dependencies{};
 };
 
 using cmodule = std::pair<std::string, module_contents>;
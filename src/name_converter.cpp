@@ -18,89 +18,115 @@
 #include "name_converter.h"
 
 #include <algorithm>
-#include <cctype>
+#include <iterator>
 #include <optional>
 
-#include <fmt/format.h>
 #include <gsl/gsl_assert>
 #include <gsl/gsl_util>
 
 using namespace ffi;
 
 namespace {
+// C identifiers are ASCII, and <cctype> goes through the locale.
+constexpr bool is_upper(char c) noexcept { return 'A' <= c && c <= 'Z'; }
+constexpr bool is_lower(char c) noexcept { return 'a' <= c && c <= 'z'; }
+constexpr bool is_alpha(char c) noexcept { return is_upper(c) || is_lower(c); }
+constexpr bool is_alnum(char c) noexcept {
+  return is_alpha(c) || ('0' <= c && c <= '9');
+}
+constexpr char to_upper(char c) noexcept {
+  return is_lower(c) ? gsl::narrow_cast<char>(c - 'a' + 'A') : c;
+}
+constexpr char to_lower(char c) noexcept {
+  return is_upper(c) ? gsl::narrow_cast<char>(c - 'A' + 'a') : c;
+}
 
 auto name_break(std::string_view input) noexcept
     -> std::optional<std::pair<std::string_view, std::string_view>> {
   if (input.empty()) return std::nullopt;
-  const auto p1 = std::find_if_not(begin(input), end(input), isalnum);
+  const auto p1 = std::find_if_not(begin(input), end(input), is_alnum);
   const auto p2 = [p1, input] {
-    const auto alpha_upper = [](char c) { return !isalpha(c) || isupper(c); };
+    const auto alpha_upper = [](char c) { return !is_alpha(c) || is_upper(c); };
     if (std::all_of(begin(input), p1, alpha_upper)) return p1;
-    const auto second_upper = [](char, char c) { return isupper(c); };
-    return std::adjacent_find(begin(input), p1, second_upper);
+    // Break before the upper case letter, not after the letter before it.
+    const auto second_upper = [](char, char c) { return is_upper(c); };
+    const auto p = std::adjacent_find(begin(input), p1, second_upper);
+    return p == p1 ? p1 : std::next(p);
   }();
   const auto d = p2 - begin(input);
   const auto p_rest = d + (p1 == p2 && p1 != end(input));
   return std::pair{input.substr(0, d), input.substr(p_rest)};
 }
 
-std::string case_convert_fragment(std::string_view word, name_case c) {
-  if (word.empty()) return "";
-  std::string res{};
+// Convert 'word' to 'out', which may overlap with 'word' from the left.
+char* case_convert_fragment(std::string_view word, name_case c,
+                            char* out) noexcept {
+  if (word.empty()) return out;
   switch (c) {
     case name_case::snake_all_upper:
-      for (auto ch : word) res.push_back(gsl::narrow_cast<char>(toupper(ch)));
+      for (auto ch : word) *out++ = to_upper(ch);
       break;
     case name_case::camel:
     case name_case::snake_init_upper:
-      res.push_back(gsl::narrow_cast<char>(toupper(word[0])));
+      *out++ = to_upper(word[0]);
       word.remove_prefix(1);
       [[fallthrough]];
     case name_case::snake_all_lower:
-      for (auto ch : word) res.push_back(gsl::narrow_cast<char>(tolower(ch)));
+      for (auto ch : word) *out++ = to_lower(ch);
       break;
     case name_case::preserving:
       Expects(false);
   }
-  return res;
+  return out;
 }
 
-std::string case_convert(std::string_view name, name_case c, name_variant v) {
-  if (c == name_case::preserving) return std::string{name};
-  std::string res{};
-  for (std::string_view word; auto p = name_break(name);) {
-    std::tie(word, name) = p.value();
-    res.append(case_convert_fragment(word, c));
+// Fragments never grow, so the conversion is done in place.
+void case_convert(std::string& name, name_case c, name_variant v) noexcept {
+  if (c == name_case::preserving) return;
+  const auto out = name.data();
+  auto end = out;
+  std::string_view rest{name};
+  for (std::string_view word; auto p = name_break(rest);) {
+    std::tie(word, rest) = p.value();
+    end = case_convert_fragment(word, c, end);
   }
-  Expects(!res.empty());
-  if (v == name_variant::preserving) return res;
+  name.resize(end - out);
+  Expects(!name.empty());
+  if (v == name_variant::preserving) return;
   if (v == name_variant::variable)
-    res[0] = gsl::narrow_cast<char>(tolower(res[0]));
+    name[0] = to_lower(name[0]);
   else
-    res[0] = gsl::narrow_cast<char>(toupper(res[0]));
-  return res;
+    name[0] = to_upper(name[0]);
+}
+
+bool starts_with(std::string_view s, std::string_view prefix) noexcept {
+  return s.substr(0, prefix.size()) == prefix;
 }
 
+bool ends_with(std::string_view s, std::string_view suffix) noexcept {
+  return s.size() >= suffix.size() &&
+         s.substr(s.size() - suffix.size()) == suffix;
+}
 }  // namespace
 
 std::string name_converter::convert(std::string_view s) const noexcept {
+  std::string buffer{s};
+  convert_in_place(buffer);
+  return buffer;
+}
+
+void name_converter::convert_in_place(std::string& buffer) const noexcept {
   // remove prefix
-  if (auto [p1, p2] = std::mismatch(begin(remove_prefix), end(remove_prefix),
-                                    begin(s), end(s));
-      p1 == end(remove_prefix))
-    s.remove_prefix(remove_prefix.length());
+  if (starts_with(buffer, remove_prefix)) buffer.erase(0, remove_prefix.size());
   // remove suffix
-  if (auto [p1, p2] = std::mismatch(rbegin(remove_prefix), rend(remove_prefix),
-                                    rbegin(s), rend(s));
-      p1 == rend(remove_prefix))
-    s.remove_suffix(remove_suffix.length());
+  if (ends_with(buffer, remove_suffix))
+    buffer.resize(buffer.size() - remove_suffix.size());
   // add prefix/suffix
-  std::string buffer = format(FMT_STRING("{}{}{}"), add_prefix, s, add_suffix);
+  buffer.insert(0, add_prefix).append(add_suffix);
   // convert
   if (forward_converter && !afterward)
-    buffer = forward_converter->convert(buffer);
-  buffer = case_convert(buffer, output_case, output_variant);
-  if (forward_converter && afterward) return forward_converter->convert(buffer);
-  // result
-  return buffer;
+    forward_converter->convert_in_place(buffer);
+  case_convert(buffer, output_case, output_variant);
+  if (forward_converter && afterward)
+    forward_converter->convert_in_place(buffer);
 }
@@ -49,6 +49,8 @@ struct name_converter {
   std::string add_suffix{};
 
   [[nodiscard]] std::string convert(std::string_view) const noexcept;
+  // Same as 'convert', reusing the storage of 'buffer' for the result.
+  void convert_in_place(std::string& buffer) const noexcept;
 };
 
 using name_converter_map = std::map<std::string, name_converter, std::less<>>;
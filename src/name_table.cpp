@@ -0,0 +1,138 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "name_table.h"
+
+#include <algorithm>
+#include <array>
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace {
+constexpr std::array<std::string_view, 29> haskell_keyword_list{
+    "as",        "case",   "class",  "data",    "default", "deriving",
+    "do",        "else",   "forall", "foreign", "hiding",  "if",
+    "in",        "import", "infix",  "infixl",  "infixr",  "instance",
+    "let",       "mdo",    "module", "newtype", "of",      "proc",
+    "qualified", "rec",    "then",   "type",    "where",
+};
+
+// Keywords are not empty.
+constexpr size_t keyword_hash(std::string_view name) {
+  return (name.size() * 2 + name.front() * 34u + name.back()) & 63u;
+}
+
+constexpr auto haskell_keywords = [] {
+  std::array<std::string_view, 64> res{};
+  for (const auto k : haskell_keyword_list) res[keyword_hash(k)] = k;
+  return res;
+}();
+
+constexpr bool is_perfect_hash() {
+  std::array<bool, haskell_keywords.size()> used{};
+  for (const auto k : haskell_keyword_list) {
+    if (used[keyword_hash(k)]) return false;
+    used[keyword_hash(k)] = true;
+  }
+  return true;
+}
+static_assert(is_perfect_hash(), "keyword_hash has collisions");
+}  // namespace
+
+size_t ffi::name_table::hash(scoped_name_view n) noexcept {
+  const llvm::StringRef scope{n.scope.data(), n.scope.size()};
+  const llvm::StringRef name{n.name.data(), n.name.size()};
+  return llvm::hash_combine(scope, name);
+}
+
+size_t ffi::name_table::probe(scoped_name_view n, size_t h) const noexcept {
+  // The capacity is a power of 2, and the table is at most half full.
+  const auto mask = slots.size() - 1;
+  for (auto i = h & mask;; i = (i + 1) & mask) {
+    const auto s = slots[i];
+    if (s == 0) return i;
+    const auto& e = entries[s - 1];
+    if (e.hash == h && e.key() == n) return i;
+  }
+}
+
+const std::string* ffi::name_table::find(scoped_name_view n) const noexcept {
+  if (slots.empty()) return nullptr;
+  const auto s = slots[probe(n, hash(n))];
+  return s == 0 ? nullptr : &entries[s - 1].value;
+}
+
+std::pair<ffi::name_table::entry*, bool> ffi::name_table::try_emplace(
+    scoped_name_view n, std::string_view value) {
+  if (2 * (entries.size() + 1) > slots.size())
+    rehash(std::max<size_t>(16, 2 * slots.size()));
+  const auto h = hash(n);
+  auto& s = slots[probe(n, h)];
+  if (s != 0) return {&entries[s - 1], false};
+  entries.push_back({std::string{n.scope}, std::string{n.name},
+                     std::string{value}, h});
+  s = static_cast<uint32_t>(entries.size());
+  return {&entries.back(), true};
+}
+
+std::vector<const ffi::name_table::entry*> ffi::name_table::sorted() const {
+  std::vector<const entry*> res;
+  res.reserve(entries.size());
+  for (const auto& e : entries) res.push_back(&e);
+  std::sort(res.begin(), res.end(), [](const entry* lhs, const entry* rhs) {
+    return lhs->key() < rhs->key();
+  });
+  return res;
+}
+
+void ffi::name_table::rehash(size_t capacity) {
+  slots.assign(capacity, 0);
+  const auto mask = capacity - 1;
+  for (size_t k = 0; k < entries.size(); ++k) {
+    auto i = entries[k].hash & mask;
+    while (slots[i] != 0) i = (i + 1) & mask;
+    slots[i] = static_cast<uint32_t>(k + 1);
+  }
+}
+
+bool ffi::is_haskell_keyword(std::string_view name) noexcept {
+  return !name.empty() && haskell_keywords[keyword_hash(name)] == name;
+}
+
+bool ffi::clash_index::insert(std::string_view name, scoped_name_view source) {
+  const auto [p, inserted] =
+      index.try_emplace({name.data(), name.size()}, groups.size());
+  if (inserted) {
+    groups.push_back({name, {source}});
+    if (!is_haskell_keyword(name)) return false;
+    clashing.push_back(p->second);
+    return true;
+  }
+  auto& g = groups[p->second];
+  g.sources.push_back(source);
+  if (g.sources.size() == 2 && !is_haskell_keyword(name))
+    clashing.push_back(p->second);
+  return true;
+}
+
+std::vector<const ffi::clash_index::group*> ffi::clash_index::clashes() const {
+  std::vector<const group*> res;
+  res.reserve(clashing.size());
+  for (const auto i : clashing) res.push_back(&groups[i]);
+  return res;
+}
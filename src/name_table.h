@@ -0,0 +1,107 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace ffi {
+struct scoped_name_view {
+  std::string_view scope{};
+  std::string_view name{};
+};
+
+inline bool operator<(scoped_name_view n1, scoped_name_view n2) {
+  return n1.scope < n2.scope || (n1.scope == n2.scope && n1.name < n2.name);
+}
+
+inline bool operator==(scoped_name_view n1, scoped_name_view n2) {
+  return n1.scope == n2.scope && n1.name == n2.name;
+}
+
+// Map from scoped C names to Haskell names. Entries are never removed, and
+// stay at the same address, so views into them are stable. Lookups hash the
+// name once, and probe an open-addressing index without allocating.
+class name_table {
+ public:
+  struct entry {
+    std::string scope;
+    std::string name;
+    std::string value;
+    size_t hash;
+
+    [[nodiscard]] scoped_name_view key() const { return {scope, name}; }
+  };
+
+  [[nodiscard]] const std::string* find(scoped_name_view n) const noexcept;
+  // Insert 'n' with 'value', unless it is already in the table. Returns the
+  // entry for 'n', and whether it is inserted.
+  std::pair<entry*, bool> try_emplace(scoped_name_view n,
+                                      std::string_view value = {});
+
+  [[nodiscard]] size_t size() const noexcept { return entries.size(); }
+  [[nodiscard]] bool empty() const noexcept { return entries.empty(); }
+  // In order of insertion.
+  [[nodiscard]] auto begin() const noexcept { return entries.cbegin(); }
+  [[nodiscard]] auto end() const noexcept { return entries.cend(); }
+  // Sorted by scope and name, for stable output.
+  [[nodiscard]] std::vector<const entry*> sorted() const;
+
+ private:
+  static size_t hash(scoped_name_view n) noexcept;
+  // Index in 'slots' where 'n' is, or should be inserted.
+  [[nodiscard]] size_t probe(scoped_name_view n, size_t h) const noexcept;
+  void rehash(size_t capacity);
+
+  std::deque<entry> entries;
+  // 0 for an empty slot, otherwise 1 + index into 'entries'.
+  std::vector<uint32_t> slots;
+};
+
+bool is_haskell_keyword(std::string_view name) noexcept;
+
+// Reverse index from Haskell names to the C names converted to them, within
+// one scope. Clashes are found as names are inserted.
+class clash_index {
+ public:
+  struct group {
+    std::string_view name;
+    llvm::SmallVector<scoped_name_view, 1> sources;
+  };
+
+  // Take note that 'source' converts to 'name'. Both must outlive the index.
+  // Returns whether 'name' clashes, with another name or a Haskell keyword.
+  bool insert(std::string_view name, scoped_name_view source);
+
+  // Groups with clashes, in the order they are found.
+  [[nodiscard]] std::vector<const group*> clashes() const;
+
+ private:
+  llvm::DenseMap<llvm::StringRef, size_t> index;
+  std::vector<group> groups;
+  std::vector<size_t> clashing;
+};
+}  // namespace ffi
@@ -0,0 +1,49 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "output_file.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+ffi::write_status ffi::write_if_changed(llvm::StringRef path,
+                                        llvm::StringRef contents) {
+  namespace fs = llvm::sys::fs;
+  if (auto old = llvm::MemoryBuffer::getFile(path))
+    if (old.get()->getBuffer() == contents) return write_status::unchanged;
+
+  int fd{};
+  llvm::SmallString<128> temp;
+  if (fs::createUniqueFile(path + "-%%%%%%.tmp", fd, temp))
+    return write_status::failed;
+  {
+    llvm::raw_fd_ostream os{fd, /* shouldClose = */ true};
+    os << contents;
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      fs::remove(temp);
+      return write_status::failed;
+    }
+  }
+  if (fs::rename(temp, path)) {
+    fs::remove(temp);
+    return write_status::failed;
+  }
+  return write_status::written;
+}
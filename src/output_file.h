@@ -0,0 +1,30 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+namespace ffi {
+enum class write_status { written, unchanged, failed };
+
+// Write 'contents' to 'path', unless the file already has exactly these
+// contents, in which case it is left alone and keeps its modification time.
+// The new contents go to a temporary file next to 'path' first, and replace
+// 'path' by renaming, so readers never see a partially written file.
+write_status write_if_changed(llvm::StringRef path, llvm::StringRef contents);
+}  // namespace ffi
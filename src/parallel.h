@@ -0,0 +1,96 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace ffi {
+// Number of workers to use for a user-specified job count, 0 for "all cores".
+inline unsigned effective_jobs(unsigned jobs) {
+  if (jobs != 0) return jobs;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Call f(worker, i) for every i in [0, count) on at most 'jobs' threads.
+// Indices are handed out one at a time from a shared cursor, so an idle
+// worker always picks up the next pending item, however uneven the items
+// are. The calling thread participates as worker 0.
+template <typename F>
+void parallel_for(unsigned jobs, size_t count, F f) {
+  const auto n = static_cast<unsigned>(
+      std::min<size_t>(std::max(1u, jobs), std::max<size_t>(1, count)));
+  std::atomic<size_t> cursor{0};
+  const auto worker = [&cursor, &f, count](unsigned w) {
+    for (auto i = cursor++; i < count; i = cursor++) f(w, i);
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(n - 1);
+  for (unsigned w = 1; w < n; ++w) threads.emplace_back(worker, w);
+  worker(0);
+  for (auto& t : threads) t.join();
+}
+
+// A queue holding at most 'capacity' items between threads: 'push' waits
+// while it is full, and 'pop' waits while it is empty and not closed.
+template <typename T>
+class bounded_queue {
+ public:
+  explicit bounded_queue(size_t capacity)
+      : capacity{std::max<size_t>(1, capacity)} {}
+
+  void push(T item) {
+    std::unique_lock lock{mutex};
+    not_full.wait(lock, [this] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+  }
+
+  // std::nullopt once the queue is closed and empty.
+  std::optional<T> pop() {
+    std::unique_lock lock{mutex};
+    not_empty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) return std::nullopt;
+    auto res = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return res;
+  }
+
+  // No more items will be pushed.
+  void close() {
+    std::lock_guard lock{mutex};
+    closed = true;
+    not_empty.notify_all();
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed{false};
+};
+}  // namespace ffi
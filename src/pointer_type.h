@@ -17,11 +17,9 @@
 
 #pragma once
 
-#include <memory>
-
 namespace ffi {
 struct ctype;
 struct pointer_type {
-  std::unique_ptr<ctype> pointee;
+  const ctype* pointee;
 };
 }  // namespace ffi
@@ -0,0 +1,155 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "prelude.h"
+
+#include <fstream>
+
+#include <clang/Basic/Version.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/xxhash.h>
+
+#include <fmt/format.h>
+
+#include "driver.h"
+
+namespace {
+class prelude_action final : public clang::GeneratePCHAction {
+ public:
+  prelude_action(std::string output, std::vector<std::string>& inputs)
+      : output{std::move(output)}, inputs{inputs} {}
+
+ protected:
+  bool BeginInvocation(clang::CompilerInstance& ci) override {
+    ci.getFrontendOpts().OutputFile = output;
+    return GeneratePCHAction::BeginInvocation(ci);
+  }
+
+  void EndSourceFileAction() override {
+    inputs = ffi::source_files(getCompilerInstance().getSourceManager());
+    GeneratePCHAction::EndSourceFileAction();
+  }
+
+ private:
+  std::string output;
+  std::vector<std::string>& inputs;
+};
+
+class prelude_factory final : public clang::tooling::FrontendActionFactory {
+ public:
+  prelude_factory(std::string output, std::vector<std::string>& inputs)
+      : output{std::move(output)}, inputs{inputs} {}
+
+  clang::FrontendAction* create() override {
+    return new prelude_action{output, inputs};
+  }
+
+ private:
+  std::string output;
+  std::vector<std::string>& inputs;
+};
+
+std::string prelude_key(const ffi::config& cfg) {
+  std::string key = clang::getClangFullVersion();
+  // Relative include paths are relative to the root directory.
+  llvm::SmallString<128> cwd;
+  llvm::sys::fs::current_path(cwd);
+  key.append(1, '\0') += cwd.str();
+  for (const auto& opt : cfg.compiler_options) key.append(1, '\0') += opt;
+  key.push_back('\n');
+  for (const auto& header : cfg.precompiled_prelude)
+    key.append(1, '\0') += header;
+  return fmt::format(FMT_STRING("{:016x}"), llvm::xxHash64(key));
+}
+
+// Files a PCH was built from, as recorded in 'inputs'.
+std::optional<std::vector<std::string>> read_inputs(const std::string& inputs) {
+  std::ifstream ifs{inputs};
+  if (!ifs) return std::nullopt;
+  std::vector<std::string> res;
+  for (std::string file; std::getline(ifs, file);) res.push_back(file);
+  return res;
+}
+
+// A PCH is up to date if every file it was built from is older than itself.
+bool up_to_date(const std::string& pch,
+                const std::vector<std::string>& inputs) {
+  namespace fs = llvm::sys::fs;
+  fs::file_status pch_status;
+  if (fs::status(pch, pch_status)) return false;
+  for (const auto& file : inputs) {
+    fs::file_status file_status;
+    if (fs::status(file, file_status) ||
+        file_status.getLastModificationTime() >
+            pch_status.getLastModificationTime())
+      return false;
+  }
+  return true;
+}
+}  // namespace
+
+std::optional<ffi::prelude> ffi::prepare_prelude(
+    const config& cfg, const clang::tooling::CompilationDatabase& compilations,
+    spdlog::logger& logger) {
+  if (cfg.precompiled_prelude.empty()) return std::nullopt;
+  // A PCH only works with the options it is built with, not per-file ones.
+  if (!cfg.compilation_database.empty()) {
+    logger.warn("Ignoring 'precompiled_prelude' with a compilation database.");
+    return std::nullopt;
+  }
+
+  const auto dir = cache_directory(cfg);
+  const auto stem =
+      fmt::format(FMT_STRING("{}/prelude-{}"), dir, prelude_key(cfg));
+  auto header = stem + ".h", pch = stem + ".pch", inputs = stem + ".d";
+  if (auto files = read_inputs(inputs); files && up_to_date(pch, *files)) {
+    logger.debug("Reusing precompiled prelude '{}'.", pch);
+    return prelude{std::move(pch), std::move(*files)};
+  }
+
+  llvm::sys::fs::create_directories(dir);
+  {
+    std::ofstream ofs{header, std::ios::out};
+    if (!ofs) {
+      logger.warn("Cannot open file '{}', prelude is not precompiled.", header);
+      return std::nullopt;
+    }
+    for (const auto& h : cfg.precompiled_prelude)
+      if (!h.empty() && (h.front() == '<' || h.front() == '"'))
+        ofs << "#include " << h << '\n';
+      else
+        ofs << "#include <" << h << ">\n";
+  }
+
+  logger.debug("Building precompiled prelude '{}'.", pch);
+  std::vector<std::string> files;
+  clang::tooling::ClangTool tool{compilations, header};
+  prelude_factory factory{pch, files};
+  if (const auto status = tool.run(&factory)) {
+    logger.warn(
+        "Failed to precompile the prelude (status {}), continuing without it.",
+        status);
+    return std::nullopt;
+  }
+
+  std::ofstream ofs{inputs, std::ios::out};
+  for (const auto& f : files) ofs << f << '\n';
+  return prelude{std::move(pch), std::move(files)};
+}
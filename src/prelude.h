@@ -0,0 +1,48 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <clang/Tooling/CompilationDatabase.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.h"
+
+namespace ffi {
+struct prelude {
+  // Path to the PCH
+  std::string pch;
+  // Files the PCH is built from. Modules depend on all of them, although
+  // Clang only opens those it needs when parsing a module.
+  std::vector<std::string> inputs;
+};
+
+// Get a precompiled header for 'cfg.precompiled_prelude', building it if
+// there is no up-to-date one in the cache directory. The PCH is keyed by the
+// Clang version, the root directory, the compiler options, and the prelude
+// headers.
+// Returns std::nullopt if there is no prelude, the files have their own
+// commands from a 'compilation_database', or the PCH fails to build.
+std::optional<prelude> prepare_prelude(
+    const config& cfg, const clang::tooling::CompilationDatabase& compilations,
+    spdlog::logger& logger);
+}  // namespace ffi
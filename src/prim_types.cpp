@@ -17,12 +17,57 @@
 
 #include "prim_types.h"
 
-#include <regex>
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <tuple>
 
 #include <llvm/IR/DiagnosticInfo.h>
 
 #include <fmt/format.h>
 
+namespace {
+using ffi::scalar_type;
+
+struct fixed_scalar {
+  std::string_view name;
+  scalar_type type;
+};
+
+constexpr fixed_scalar fixed_scalar_list[]{
+    {"wchar_t", {scalar_type::Unspecified, scalar_type::Wchar,
+                 scalar_type::WidthNone}},
+    {"char8_t", {scalar_type::Unsigned, scalar_type::UniChar,
+                 scalar_type::Width8}},
+    {"char16_t", {scalar_type::Unsigned, scalar_type::UniChar,
+                  scalar_type::Width16}},
+    {"char32_t", {scalar_type::Unsigned, scalar_type::UniChar,
+                  scalar_type::Width32}},
+    {"size_t", {scalar_type::None, scalar_type::Size, scalar_type::WidthNone}},
+    {"ptrdiff_t", {scalar_type::None, scalar_type::Ptrdiff,
+                   scalar_type::WidthNone}},
+};
+
+// The names above differ in their 5th character modulo 16.
+constexpr size_t fixed_hash(std::string_view name) { return name[4] & 15u; }
+
+constexpr auto fixed_scalars = [] {
+  std::array<const fixed_scalar*, 16> res{};
+  for (const auto& s : fixed_scalar_list) res[fixed_hash(s.name)] = &s;
+  return res;
+}();
+
+constexpr bool is_perfect_hash() {
+  std::array<bool, fixed_scalars.size()> used{};
+  for (const auto& s : fixed_scalar_list) {
+    if (s.name.size() <= 4 || used[fixed_hash(s.name)]) return false;
+    used[fixed_hash(s.name)] = true;
+  }
+  return true;
+}
+static_assert(is_perfect_hash(), "fixed_hash has collisions");
+}  // namespace
+
 std::string ffi::scalar_type::as_haskell() const noexcept {
   constexpr const char* chQual[]{"CU", "CS", "C"};
   if (qualifier == Void) return "()";
@@ -84,41 +129,46 @@ std::optional<ffi::scalar_type> ffi::scalar_type::from_clang(
 
 std::optional<ffi::scalar_type> ffi::scalar_type::from_name(
     std::string_view type) noexcept {
-  static const std::map<std::string_view, scalar_type> scalar_types{
-      {"wchar_t", {Unspecified, Wchar, WidthNone}},
-      {"char8_t", {Unsigned, UniChar, Width8}},
-      {"char16_t", {Unsigned, UniChar, Width16}},
-      {"char32_t", {Unsigned, UniChar, Width32}},
-      {"size_t", {None, Size, WidthNone}},
-      {"ptrdiff_t", {None, Ptrdiff, WidthNone}},
-  };
-  if (const auto p = scalar_types.find(type); p != scalar_types.cend())
-    return p->second;
+  if (type.size() > 4)
+    if (const auto p = fixed_scalars[fixed_hash(type)]; p && p->name == type)
+      return p->type;
 
-  static const std::regex reg{
-      "(u)?int(ptr|max|(?:_(least|fast))?([1-9][0-9]*))_t",
-      std::regex::ECMAScript | std::regex::optimize};
-  std::match_results<std::string_view::const_iterator> match{};
-  std::regex_match(type.cbegin(), type.cend(), match, reg);
-
-  if (match.empty()) return std::nullopt;
+  // (u)?int(ptr|max|(_(least|fast))?([1-9][0-9]*))_t
+  const auto consume = [&type](std::string_view prefix) {
+    if (type.substr(0, prefix.size()) != prefix) return false;
+    type.remove_prefix(prefix.size());
+    return true;
+  };
+  scalar_type res{consume("u") ? Unsigned : Signed, Special, WidthNone};
+  if (!consume("int") || type.size() < 2 ||
+      type.substr(type.size() - 2) != "_t")
+    return std::nullopt;
+  type.remove_suffix(2);
 
-  scalar_type res{match[1].matched ? Unsigned : Signed, Special, WidthNone};
-  if (const auto c = *match[2].first; c == 'p')
+  if (type == "ptr") {
     res.width = WidthPtr;
-  else if (c == 'm')
+    return res;
+  }
+  if (type == "max") {
     res.width = WidthMax;
-  else if (c == '_')
-    res.qualifier = *match[3].first == 'l' ? Least : Fast;
-  if (match[4].matched) {
-    constexpr std::tuple<std::string_view, Width> width[]{
-        {"8", Width8}, {"16", Width16}, {"32", Width32}, {"64", Width64}};
-    for (const auto& [w, v] : width)
-      if (match[4].str() == w) {
-        res.width = v;
-        break;
-      }
-    res.qualifier = Exact;
+    return res;
   }
+  if (consume("_least"))
+    res.qualifier = Least;
+  else if (consume("_fast"))
+    res.qualifier = Fast;
+  else
+    res.qualifier = Exact;
+  if (type.empty() || type.front() == '0' ||
+      !std::all_of(type.cbegin(), type.cend(),
+                   [](char c) { return '0' <= c && c <= '9'; }))
+    return std::nullopt;
+  constexpr std::tuple<std::string_view, Width> width[]{
+      {"8", Width8}, {"16", Width16}, {"32", Width32}, {"64", Width64}};
+  for (const auto& [w, v] : width)
+    if (type == w) {
+      res.width = v;
+      break;
+    }
   return res;
 }
@@ -0,0 +1,586 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <fmt/format.h>
+#include <gsl/gsl_util>
+#include <nlohmann/json.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "config.h"
+#include "driver.h"
+#include "haskell_code_gen.h"
+#include "manifest.h"
+#include "parallel.h"
+#include "prelude.h"
+#include "yaml.h"
+
+#if LLVM_ON_UNIX
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace {
+using nlohmann::json;
+
+// JSON-RPC 2.0 error codes
+constexpr int parse_error = -32700;
+constexpr int invalid_request = -32600;
+constexpr int method_not_found = -32601;
+constexpr int invalid_params = -32602;
+constexpr int generation_failed = -32000;
+
+json error(int code, std::string_view message) {
+  return {{"error", {{"code", code}, {"message", std::string{message}}}}};
+}
+
+const char* status_name(std::optional<ffi::write_status> status) {
+  if (!status.has_value()) return "skipped";
+  switch (*status) {
+    case ffi::write_status::written: return "written";
+    case ffi::write_status::unchanged: return "unchanged";
+    case ffi::write_status::failed: return "failed";
+  }
+  return "failed";
+}
+
+// What is kept of a configuration file between requests.
+struct session {
+  // Contents of the configuration file, 'driver' is for these contents.
+  std::string source;
+  // Types and modules parsed so far.
+  std::unique_ptr<ffi::ffi_driver> driver;
+  // Fingerprints of the modules in 'driver'.
+  ffi::manifest manifest;
+  std::shared_ptr<spdlog::logger> logger;
+  // Files all the modules depend on: the configuration file, the template,
+  // and the compilation database.
+  std::vector<std::string> globals;
+  // Files in 'file_names', by absolute path. Along with 'globals', these are
+  // known even if the modules cannot be generated.
+  std::map<std::string, std::string, std::less<>> sources;
+  // Files in 'file_names' whose modules depend on a file, by absolute path.
+  std::map<std::string, std::vector<std::string>, std::less<>> dependents;
+};
+
+class server {
+ public:
+  explicit server(unsigned jobs) : jobs{jobs} {}
+
+  // The response to 'request', or a null value for a notification.
+  json handle(const json& request);
+  // Generate 'cfg_file', only the modules of 'files' if it is not empty.
+  // Returns an object with either "result" or "error".
+  json generate(const std::string& cfg_file,
+                const std::vector<std::string>& files);
+  [[nodiscard]] bool stopped() const { return stop; }
+
+  // Configuration files generated so far, with the files in 'file_names'
+  // whose modules depend on some file in 'changed'. The list is empty if all
+  // the modules do, or the configuration file itself changed.
+  [[nodiscard]] std::map<std::string, std::vector<std::string>> affected(
+      const std::set<std::string, std::less<>>& changed) const;
+  // All the files some configuration generated so far depends on.
+  [[nodiscard]] std::set<std::string, std::less<>> dependencies() const;
+
+ private:
+  std::map<std::string, session, std::less<>> sessions;
+  unsigned jobs;
+  bool stop{false};
+};
+
+json server::handle(const json& request) {
+  json response{{"jsonrpc", "2.0"}, {"id", nullptr}};
+  if (!request.is_object()) {
+    response.update(error(invalid_request, "Request is not an object."));
+    return response;
+  }
+  const auto id = request.find("id");
+  if (id != request.end()) response["id"] = *id;
+  const auto method = request.find("method");
+  if (method == request.end() || !method->is_string()) {
+    response.update(error(invalid_request, "Request has no method."));
+    return response;
+  }
+
+  if (*method == "shutdown") {
+    stop = true;
+    response["result"] = nullptr;
+  } else if (*method == "generate") {
+    try {
+      const auto& params = request.at("params");
+      std::vector<std::string> files;
+      if (const auto p = params.find("files"); p != params.end())
+        files = p->get<std::vector<std::string>>();
+      // The server does not know the working directory of the client.
+      auto cfg_file = params.at("config").get<std::string>();
+      if (llvm::sys::path::is_absolute(cfg_file))
+        response.update(generate(cfg_file, files));
+      else
+        response.update(error(invalid_params,
+                              "Configuration file path is not absolute."));
+    } catch (const json::exception& e) {
+      response.update(error(invalid_params, e.what()));
+    }
+  } else {
+    response.update(error(method_not_found, "Unknown method."));
+  }
+  return id == request.end() ? json{} : response;
+}
+
+json server::generate(const std::string& cfg_file,
+                      const std::vector<std::string>& files) {
+  llvm::SmallString<128> cfg_path{cfg_file};
+  llvm::sys::fs::make_absolute(cfg_path);
+  // A broken configuration file is still watched, to be generated once fixed.
+  auto& s = sessions[cfg_path.str().str()];
+  s.globals = {cfg_path.str().str()};
+  auto contents = llvm::MemoryBuffer::getFile(cfg_path);
+  if (auto ec = contents.getError())
+    return error(invalid_params,
+                 fmt::format(FMT_STRING("Failed to load configuration file "
+                                        "\"{}\": {}"),
+                             cfg_file, ec.message()));
+
+  // The parsed modules are kept as long as the configuration is the same.
+  if (!s.logger) s.logger = spdlog::stderr_color_st(cfg_path.str().str());
+  if (!s.driver || s.source != contents.get()->getBuffer()) {
+    s.source = contents.get()->getBuffer().str();
+    s.driver = std::make_unique<ffi::ffi_driver>();
+    s.manifest = {};
+  }
+  auto& driver = *s.driver;
+  auto& logger = *s.logger;
+
+  // Name tables are filled while generating, start over from the file.
+  driver.cfg = ffi::config{};
+  llvm::yaml::Input input{s.source};
+  input >> driver.cfg;
+  if (input.error() || !ffi::validate_config(driver.cfg, logger)) {
+    s.driver.reset();
+    return error(invalid_params, "Invalid configuration file.");
+  }
+
+  // Load CWD
+  llvm::SmallString<128> current_path;
+  llvm::sys::fs::current_path(current_path);
+  if (!driver.cfg.root_directory.empty())
+    llvm::sys::fs::set_current_path(driver.cfg.root_directory);
+  const auto recover_cwd =
+      gsl::finally([&] { llvm::sys::fs::set_current_path(current_path); });
+
+  // Files to watch, before anything may fail
+  for (const auto& f : {driver.cfg.custom_template,
+                        ffi::compilation_database_file(driver.cfg)})
+    if (!f.empty()) {
+      llvm::SmallString<128> path{f};
+      llvm::sys::fs::make_absolute(path);
+      s.globals.push_back(path.str().str());
+    }
+  s.sources.clear();
+  for (const auto& f : driver.cfg.file_names) {
+    llvm::SmallString<128> path{f};
+    llvm::sys::fs::make_absolute(path);
+    s.sources.emplace(path.str().str(), f);
+  }
+
+  ffi::haskell_code_gen code_gen{driver.cfg};
+  if (!code_gen.valid())
+    return error(generation_failed, "Invalid output template.");
+
+  // Requested modules
+  std::set<std::string, std::less<>> selected;
+  for (const auto& f : files)
+    selected.insert(ffi::module_name_of(driver.cfg, f));
+  const auto is_selected = [&](const std::string& name) {
+    return selected.empty() || selected.count(name) != 0;
+  };
+
+  // Parse the modules whose fingerprints changed
+  std::string db_error;
+  const auto compilations = ffi::make_compilations(driver.cfg, db_error);
+  if (!compilations)
+    return error(invalid_params, "Cannot load compilation database: " +
+                                     db_error);
+  ffi::fingerprinter fingerprint{ffi::context_fingerprint(driver.cfg)};
+  auto stale = ffi::stale_files(driver.cfg, s.manifest, fingerprint);
+  // A unity build parses all files or none.
+  if (!driver.cfg.unity_build)
+    stale.erase(std::remove_if(begin(stale), end(stale),
+                               [&](const std::string& f) {
+                                 return !is_selected(
+                                     ffi::module_name_of(driver.cfg, f));
+                               }),
+                end(stale));
+  std::set<std::string, std::less<>> parsed;
+  for (const auto& f : stale) {
+    auto name = ffi::module_name_of(driver.cfg, f);
+    driver.modules.erase(name);
+    parsed.insert(std::move(name));
+  }
+  logger.debug("{} of {} modules are up to date.",
+               driver.cfg.file_names.size() - stale.size(),
+               driver.cfg.file_names.size());
+
+  driver.arguments_adjuster = nullptr;
+  driver.extra_dependencies.clear();
+  if (auto prelude =
+          stale.empty()
+              ? std::nullopt
+              : ffi::prepare_prelude(driver.cfg, *compilations, logger)) {
+    driver.arguments_adjuster = clang::tooling::getInsertArgumentAdjuster(
+        {"-include-pch", prelude->pch},
+        clang::tooling::ArgumentInsertPosition::END);
+    driver.extra_dependencies = std::move(prelude->inputs);
+  }
+  if (const auto status =
+          stale.empty()
+              ? 0
+              : driver.run(*compilations, stale, ffi::effective_jobs(jobs))) {
+    // Modules may be partially collected, do not keep any of them.
+    s.driver.reset();
+    return error(generation_failed,
+                 fmt::format(
+                     FMT_STRING("Clang front-end fails with status {}."),
+                     status));
+  }
+
+  // Generate the requested modules, declare all of them first.
+  for (const auto& m : driver.modules) code_gen.declare_module(m.first);
+  for (const auto& f : driver.cfg.file_names)
+    if (auto name = ffi::module_name_of(driver.cfg, f);
+        driver.modules.find(name) == driver.modules.end())
+      code_gen.declare_module(name);
+  std::vector<ffi::module_ref> modules;
+  for (const auto& m : driver.modules)
+    if (is_selected(m.first)) modules.push_back(&m);
+  const auto statuses = ffi::gen_modules(code_gen, driver.cfg, modules,
+                                         ffi::effective_jobs(jobs));
+  const auto nc = ffi::name_clashes(driver.cfg, logger);
+  if (!nc) {
+    // Only the modules generated now are up to date. Those not requested may
+    // be stale, and those which failed to be written are generated again.
+    std::vector<ffi::module_ref> generated;
+    for (size_t i = 0; i < modules.size(); ++i)
+      if (statuses[i] != ffi::write_status::failed)
+        generated.push_back(modules[i]);
+    s.manifest = ffi::update_manifest(driver.cfg, generated, s.manifest,
+                                      code_gen, fingerprint);
+  }
+
+  // Reverse dependencies, for '--watch'
+  s.dependents.clear();
+  for (const auto& f : driver.cfg.file_names)
+    if (const auto p = driver.modules.find(ffi::module_name_of(driver.cfg, f));
+        p != driver.modules.end())
+      for (const auto& d : p->second.dependencies) s.dependents[d].push_back(f);
+
+  json result{{"modules", json::array()}, {"name_clashes", nc}};
+  for (size_t i = 0; i < modules.size(); ++i) {
+    const auto& name = modules[i]->first;
+    llvm::SmallString<128> output{code_gen.module_file(name)};
+    llvm::sys::fs::make_absolute(output);
+    result["modules"].push_back({{"name", name},
+                                 {"output", output.str().str()},
+                                 {"parsed", parsed.count(name) != 0},
+                                 {"status", status_name(statuses[i])}});
+  }
+  return {{"result", std::move(result)}};
+}
+
+std::map<std::string, std::vector<std::string>> server::affected(
+    const std::set<std::string, std::less<>>& changed) const {
+  std::map<std::string, std::vector<std::string>> res;
+  for (const auto& [cfg_file, s] : sessions) {
+    const auto all = std::any_of(
+        begin(s.globals), end(s.globals),
+        [&](const std::string& g) { return changed.count(g) != 0; });
+    std::set<std::string> files;
+    if (!all)
+      for (const auto& c : changed) {
+        if (const auto p = s.dependents.find(c); p != s.dependents.end())
+          files.insert(begin(p->second), end(p->second));
+        if (const auto p = s.sources.find(c); p != s.sources.end())
+          files.insert(p->second);
+      }
+    if (all || !files.empty())
+      res.emplace(cfg_file, all ? std::vector<std::string>{}
+                                : std::vector<std::string>{begin(files),
+                                                           end(files)});
+  }
+  return res;
+}
+
+std::set<std::string, std::less<>> server::dependencies() const {
+  std::set<std::string, std::less<>> res;
+  for (const auto& [cfg_file, s] : sessions) {
+    res.insert(begin(s.globals), end(s.globals));
+    for (const auto& f : s.sources) res.insert(f.first);
+    for (const auto& d : s.dependents) res.insert(d.first);
+  }
+  return res;
+}
+
+#ifdef __linux__
+// Generate 'cfg_file' for '--watch', and log the outcome.
+void regenerate(server& srv, const std::string& cfg_file,
+                const std::vector<std::string>& files) {
+  const auto start = std::chrono::steady_clock::now();
+  const auto r = srv.generate(cfg_file, files);
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (const auto e = r.find("error"); e != r.end()) {
+    spdlog::error("'{}': {}", cfg_file, (*e)["message"].get<std::string>());
+    return;
+  }
+  size_t written{0};
+  const auto& modules = r["result"]["modules"];
+  for (const auto& m : modules) written += m["status"] == "written";
+  spdlog::info("'{}': {} modules generated, {} written, in {:.0f} ms.",
+               cfg_file, modules.size(), written, elapsed.count());
+}
+#endif
+
+#if LLVM_ON_UNIX
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const auto n = ::write(fd, data.data(), data.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+// Read what a client sent, and handle the complete requests in 'buffer'.
+// Returns false once the client disconnects or the server stops.
+bool serve_client(server& srv, int fd, std::string& buffer) {
+  // Longest request line kept waiting for its end
+  constexpr size_t max_request = 1 << 20;
+  char chunk[4096];
+  auto n = ::read(fd, chunk, sizeof chunk);
+  while (n < 0 && errno == EINTR) n = ::read(fd, chunk, sizeof chunk);
+  if (n <= 0) return false;
+  buffer.append(chunk, static_cast<size_t>(n));
+  size_t start = 0;
+  for (auto eol = buffer.find('\n'); eol != std::string::npos;
+       start = eol + 1, eol = buffer.find('\n', start)) {
+    const std::string_view line{buffer.data() + start, eol - start};
+    if (line.find_first_not_of(" \t\r") == std::string_view::npos) continue;
+    const auto request = json::parse(line.begin(), line.end(), nullptr, false);
+    json response;
+    if (request.is_discarded()) {
+      response = {{"jsonrpc", "2.0"}, {"id", nullptr}};
+      response.update(error(parse_error, "Invalid JSON."));
+    } else {
+      response = srv.handle(request);
+    }
+    if (!response.is_null() && !write_all(fd, response.dump() + '\n'))
+      return false;
+    if (srv.stopped()) return false;
+  }
+  buffer.erase(0, start);
+  if (buffer.size() > max_request) {
+    // The rest of the request cannot be told apart from the next one.
+    json response{{"jsonrpc", "2.0"}, {"id", nullptr}};
+    response.update(error(parse_error, "Request is too long."));
+    write_all(fd, response.dump() + '\n');
+    return false;
+  }
+  return true;
+}
+#endif
+}  // namespace
+
+int ffi::serve(const std::string& socket_path,
+               llvm::ArrayRef<std::string> config_files, unsigned jobs) {
+#if LLVM_ON_UNIX
+  sockaddr_un addr{};
+  if (socket_path.size() >= sizeof addr.sun_path) {
+    spdlog::error("Socket path '{}' is too long.", socket_path);
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  std::copy(socket_path.begin(), socket_path.end(), addr.sun_path);
+
+  // A socket left behind by a previous server, unless it is still serving
+  namespace fs = llvm::sys::fs;
+  if (fs::file_status st;
+      !fs::status(socket_path, st) && st.type() == fs::file_type::socket_file) {
+    const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool live =
+        probe >= 0 && ::connect(probe, reinterpret_cast<const sockaddr*>(&addr),
+                                sizeof addr) == 0;
+    if (probe >= 0) ::close(probe);
+    if (live) {
+      spdlog::error("A server is already listening on '{}'.", socket_path);
+      return 1;
+    }
+    fs::remove(socket_path);
+  }
+
+  server srv{jobs};
+  for (const auto& f : config_files)
+    if (const auto r = srv.generate(f, {}); r.count("error"))
+      spdlog::warn("'{}': {}", f, r["error"]["message"].get<std::string>());
+
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      ::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    spdlog::error("Cannot listen on '{}': {}.", socket_path,
+                  std::strerror(errno));
+    if (fd >= 0) ::close(fd);
+    return 1;
+  }
+  // A client closing early should not kill the server.
+  ::signal(SIGPIPE, SIG_IGN);
+  spdlog::info("Serving on '{}'.", socket_path);
+
+  // Clients may stay connected between requests, an idle one does not hold
+  // off the others. Requests are handled one at a time, whichever client
+  // they come from.
+  std::vector<pollfd> fds{{fd, POLLIN, 0}};
+  std::map<int, std::string> buffers;
+  while (!srv.stopped()) {
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      spdlog::error("Cannot wait for clients: {}.", std::strerror(errno));
+      break;
+    }
+    for (size_t i = 1; i < fds.size() && !srv.stopped(); ++i)
+      if (fds[i].revents && !serve_client(srv, fds[i].fd, buffers[fds[i].fd])) {
+        ::close(fds[i].fd);
+        buffers.erase(fds[i].fd);
+        fds[i].fd = -1;
+      }
+    fds.erase(std::remove_if(begin(fds) + 1, end(fds),
+                             [](const pollfd& p) { return p.fd < 0; }),
+              end(fds));
+    if (srv.stopped() || !(fds[0].revents & POLLIN)) continue;
+    if (const int client = ::accept(fd, nullptr, nullptr); client >= 0) {
+      fds.push_back({client, POLLIN, 0});
+    } else if (errno != EINTR) {
+      spdlog::error("Cannot accept connection: {}.", std::strerror(errno));
+      break;
+    }
+  }
+  for (const auto& p : fds) ::close(p.fd);
+  fs::remove(socket_path);
+  return srv.stopped() ? 0 : 1;
+#else
+  spdlog::error("'--serve' is only supported on Unix-like systems.");
+  return 1;
+#endif
+}
+
+int ffi::watch(llvm::ArrayRef<std::string> config_files, unsigned jobs) {
+#ifdef __linux__
+  server srv{jobs};
+  for (const auto& f : config_files) regenerate(srv, f, {});
+
+  const int fd = ::inotify_init1(IN_CLOEXEC);
+  if (fd < 0) {
+    spdlog::error("Cannot watch files: {}.", std::strerror(errno));
+    return 1;
+  }
+  // Editors often save a file by replacing it, so watch the directories.
+  constexpr uint32_t mask =
+      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+  std::map<int, std::string> dirs;
+  const auto update_watches = [&] {
+    std::set<std::string> wanted;
+    for (const auto& f : srv.dependencies())
+      wanted.insert(llvm::sys::path::parent_path(f).str());
+    std::map<int, std::string> res;
+    for (const auto& d : wanted)
+      if (const int wd = ::inotify_add_watch(fd, d.c_str(), mask); wd >= 0)
+        res.emplace(wd, d);
+      else
+        spdlog::warn("Cannot watch '{}': {}.", d, std::strerror(errno));
+    for (const auto& [wd, d] : dirs)
+      if (res.count(wd) == 0) ::inotify_rm_watch(fd, wd);
+    dirs = std::move(res);
+  };
+  update_watches();
+  if (dirs.empty()) {
+    spdlog::error("Nothing to watch.");
+    ::close(fd);
+    return 1;
+  }
+  spdlog::info("Watching {} directories.", dirs.size());
+
+  // Changes are batched until there is none for a while.
+  constexpr int debounce_ms = 100;
+  std::set<std::string, std::less<>> changed;
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    pollfd p{fd, POLLIN, 0};
+    const int n = ::poll(&p, 1, changed.empty() ? -1 : debounce_ms);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) break;
+    if (n == 0) {
+      for (const auto& [cfg_file, files] : srv.affected(changed))
+        regenerate(srv, cfg_file, files);
+      changed.clear();
+      update_watches();
+      continue;
+    }
+    const auto len = ::read(fd, buffer, sizeof buffer);
+    if (len < 0 && errno == EINTR) continue;
+    if (len <= 0) break;
+    for (auto i = 0; i < len;) {
+      const auto* e = reinterpret_cast<const inotify_event*>(buffer + i);
+      if (e->mask & IN_Q_OVERFLOW) changed = srv.dependencies();
+      if (const auto d = dirs.find(e->wd); d != dirs.end() && e->len)
+        changed.insert(d->second + '/' + e->name);
+      i += static_cast<int>(sizeof(inotify_event) + e->len);
+    }
+  }
+  spdlog::error("Cannot watch files: {}.", std::strerror(errno));
+  ::close(fd);
+  return 1;
+#else
+  spdlog::error("'--watch' is only supported on Linux.");
+  return 1;
+#endif
+}
@@ -0,0 +1,55 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <llvm/ADT/ArrayRef.h>
+
+namespace ffi {
+// Serve requests to generate configuration files on a Unix domain socket at
+// 'socket_path', keeping the parsed modules of every configuration file and
+// their fingerprints between requests. A request only parses the modules
+// whose fingerprints changed, like '--incremental', and module files are only
+// written if they change. The files in 'config_files' are generated once
+// before serving. Any number of clients may stay connected, and requests from
+// all of them are handled one at a time, in the order they arrive.
+//
+// Requests and responses are JSON-RPC 2.0 objects, one per line:
+// - "generate", with params {"config": <path>, "files": [<path> ...]}, where
+//   "config" is absolute, and "files" is optional and limits the modules
+//   generated, relative to the root directory as in 'file_names'. A request
+//   line longer than 1 MiB closes the connection. The result is
+//   {"modules": [{"name", "output", "parsed", "status"} ...],
+//    "name_clashes": <count>}, where "status" is "written", "unchanged",
+//   "failed", or "skipped" (when module names clash).
+// - "shutdown", which stops the server after the response.
+// Returns non-zero if the socket cannot be set up, or another server is
+// listening on it.
+int serve(const std::string& socket_path,
+          llvm::ArrayRef<std::string> config_files, unsigned jobs);
+
+// Generate 'config_files', then watch the files every module depends on, as
+// found by Clang, and generate the modules depending on changed files again.
+// The configuration files and the files in 'file_names' are watched even if
+// they fail to generate, so that fixing them is noticed.
+// Changes are batched until there is none for 100 ms. A change to a
+// configuration file or its template affects all of its modules.
+// Only returns if the files cannot be watched.
+int watch(llvm::ArrayRef<std::string> config_files, unsigned jobs);
+}  // namespace ffi
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <variant>
 #include <vector>
@@ -24,12 +26,22 @@
 #include "types.h"
 
 namespace ffi {
+// Memory layout of a record as computed by Clang, in bytes.
+struct record_layout {
+  uint64_t size{};
+  uint64_t alignment{};
+  // one for each field, in the same order
+  std::vector<uint64_t> offsets{};
+};
+
 struct structure {
   std::vector<entity> fields{};
+  // std::nullopt if the layout cannot be expressed in bytes (bit-fields)
+  std::optional<record_layout> layout{};
 };
 
 struct enumeration {
-  ctype underlying_type{};
+  const ctype* underlying_type{};
   std::map<std::string, intmax_t, std::less<>> values{};
 };
 
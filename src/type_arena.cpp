@@ -0,0 +1,102 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "type_arena.h"
+
+#include <llvm/ADT/Hashing.h>
+
+namespace {
+llvm::hash_code hash_value(std::string_view s) {
+  return llvm::hash_value(llvm::StringRef{s.data(), s.size()});
+}
+
+// Sub-types are interned, so hashing and comparing them by address is enough.
+llvm::hash_code shallow_hash(const ffi::scalar_type& t) {
+  return llvm::hash_combine(t.sign, t.qualifier, t.width);
+}
+
+llvm::hash_code shallow_hash(const ffi::opaque_type& t) {
+  return llvm::hash_combine(hash_value(t.name), t.marshallable);
+}
+
+llvm::hash_code shallow_hash(const ffi::pointer_type& t) {
+  return llvm::hash_value(t.pointee);
+}
+
+llvm::hash_code shallow_hash(const ffi::function_type& t) {
+  auto res = llvm::hash_value(t.return_type);
+  for (const auto& [name, type] : t.params)
+    res = llvm::hash_combine(res, hash_value(name), type);
+  return res;
+}
+
+bool shallow_equal(const ffi::scalar_type& lhs, const ffi::scalar_type& rhs) {
+  return lhs.sign == rhs.sign && lhs.qualifier == rhs.qualifier &&
+         lhs.width == rhs.width;
+}
+
+bool shallow_equal(const ffi::opaque_type& lhs, const ffi::opaque_type& rhs) {
+  return lhs.name == rhs.name && lhs.marshallable == rhs.marshallable;
+}
+
+bool shallow_equal(const ffi::pointer_type& lhs,
+                   const ffi::pointer_type& rhs) {
+  return lhs.pointee == rhs.pointee;
+}
+
+bool shallow_equal(const ffi::function_type& lhs,
+                   const ffi::function_type& rhs) {
+  return lhs.return_type == rhs.return_type && lhs.params == rhs.params;
+}
+}  // namespace
+
+size_t ffi::type_arena::node_hash::operator()(const ctype* type) const
+    noexcept {
+  const auto h =
+      std::visit([](const auto& t) { return shallow_hash(t); }, type->value);
+  return llvm::hash_combine(type->value.index(), h);
+}
+
+bool ffi::type_arena::node_equal::operator()(const ctype* lhs,
+                                             const ctype* rhs) const noexcept {
+  if (lhs->value.index() != rhs->value.index()) return false;
+  return std::visit(
+      [rhs](const auto& l) {
+        using T = std::decay_t<decltype(l)>;
+        return shallow_equal(l, std::get<T>(rhs->value));
+      },
+      lhs->value);
+}
+
+const ffi::ctype* ffi::type_arena::intern(ctype type) {
+  std::lock_guard lock{mutex};
+  if (const auto p = nodes.find(&type); p != nodes.end()) return *p;
+  const auto* node = new (storage.Allocate()) ctype{std::move(type)};
+  nodes.insert(node);
+  return node;
+}
+
+std::string_view ffi::type_arena::intern(llvm::StringRef name) {
+  std::lock_guard lock{mutex};
+  const auto res = names.save(name);
+  return {res.data(), res.size()};
+}
+
+size_t ffi::type_arena::size() const {
+  std::lock_guard lock{mutex};
+  return nodes.size();
+}
@@ -0,0 +1,61 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+#include "types.h"
+
+namespace ffi {
+// Storage for the type nodes and entity names of a run. Types are
+// hash-consed: interning a type structurally equal to an existing one gives
+// back the existing node. Everything lives as long as the arena, and may be
+// interned from several threads at once.
+class type_arena {
+ public:
+  type_arena() = default;
+  type_arena(const type_arena&) = delete;
+  type_arena& operator=(const type_arena&) = delete;
+
+  // Sub-types of 'type' must already be interned in this arena.
+  const ctype* intern(ctype type);
+  std::string_view intern(llvm::StringRef name);
+
+  [[nodiscard]] size_t size() const;
+
+ private:
+  struct node_hash {
+    size_t operator()(const ctype* type) const noexcept;
+  };
+  struct node_equal {
+    bool operator()(const ctype* lhs, const ctype* rhs) const noexcept;
+  };
+
+  mutable std::mutex mutex;
+  llvm::SpecificBumpPtrAllocator<ctype> storage;
+  std::unordered_set<const ctype*, node_hash, node_equal> nodes;
+  llvm::BumpPtrAllocator name_storage;
+  llvm::UniqueStringSaver names{name_storage};
+};
+}  // namespace ffi
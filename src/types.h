@@ -36,8 +36,9 @@ struct ctype {
   variant value;
 };
 
-using entity = std::pair<std::string, ctype>;
-using const_entity = const std::pair<const std::string, ctype>;
+// Type nodes and entity names are interned in a type_arena, so two types are
+// equal exactly when they are the same node.
+using entity = std::pair<std::string_view, const ctype*>;
 
 namespace internal {
 template <typename L, typename A>
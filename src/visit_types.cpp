@@ -17,6 +17,12 @@
 
 #include "visit_types.h"
 
+#include <algorithm>
+
+#include <clang/AST/RecordLayout.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Config/llvm-config.h>
+
 namespace {
 constexpr uintptr_t invalid_id = 0;
 
@@ -43,10 +49,34 @@ inline uintptr_t getUniqueID(const clang::Decl& decl) {
       return reinterpret_cast<uintptr_t>(&decl);
   }
 }
+
+// Whether a value of type 't' is, or leads through pointers, arrays, or fields
+// to, a function pointer. Incomplete records are taken as holding none.
+using record_set = llvm::SmallPtrSetImpl<const clang::RecordDecl*>;
+bool has_function_pointer(clang::QualType t, record_set& seen) {
+  t = t.getCanonicalType();
+  if (t->isFunctionType()) return true;
+  // Pointers, references, and block pointers
+  if (const auto p = t->getPointeeType(); !p.isNull())
+    return has_function_pointer(p, seen);
+  if (const auto a = t->getAsArrayTypeUnsafe())
+    return has_function_pointer(a->getElementType(), seen);
+  if (const auto r = t->getAsRecordDecl()) {
+    const auto def = r->getDefinition();
+    if (!def || !seen.insert(def).second) return false;
+    return llvm::any_of(def->fields(), [&seen](const clang::FieldDecl* f) {
+      return has_function_pointer(f->getType(), seen);
+    });
+  }
+  return false;
+}
 }  // namespace
 
-bool ffi::ast_visitor::check_decl(const clang::Decl* decl) const {
-  if (!decl) return false;
+ffi::module_contents* ffi::ast_visitor::check_decl(
+    const clang::Decl* decl) const {
+  if (!decl) return nullptr;
+  // Templates and partial specializations have no C interface.
+  if (decl->isTemplated()) return nullptr;
   if (const auto ndecl = llvm::dyn_cast<clang::NamedDecl>(decl);
       ndecl && !ndecl->hasExternalFormalLinkage()) {
     auto& diags = context.getDiagnostics();
@@ -57,14 +87,82 @@ bool ffi::ast_visitor::check_decl(const clang::Decl* decl) const {
           "have an external formal linkage.");
       diags.Report(decl->getLocation(), id) << ndecl->getName();
     }
-    return false;
+    return nullptr;
   }
   const auto& sm = context.getSourceManager();
   const auto expansion_loc = sm.getExpansionLoc(decl->getBeginLoc());
-  if (expansion_loc.isInvalid()) return false;
-  const auto is_main_file = header_group ? !sm.isInSystemHeader(expansion_loc)
-                                         : sm.isInMainFile(expansion_loc);
-  return is_main_file && check_extern_c(*decl);
+  if (expansion_loc.isInvalid()) return nullptr;
+  const auto owner = owner_of(expansion_loc);
+  return owner && check_extern_c(*decl) ? owner : nullptr;
+}
+
+ffi::module_contents* ffi::ast_visitor::owner_of(
+    clang::SourceLocation loc) const {
+  const auto fid = context.getSourceManager().getFileID(loc);
+  auto [p, inserted] = file_owners.try_emplace(fid, nullptr);
+  if (inserted) p->second = find_owner(fid);
+  return p->second;
+}
+
+ffi::module_contents* ffi::ast_visitor::find_owner(clang::FileID fid) const {
+  const auto& sm = context.getSourceManager();
+  const auto is_system = sm.isInSystemHeader(sm.getLocForStartOfFile(fid));
+  // Walk up the include stack, until we reach a file we have a module for.
+  for (bool direct = true;; direct = false) {
+    if (const auto p = owners.find(sm.getFileEntryForID(fid));
+        p != owners.end()) {
+      const auto& owner = p->second;
+      return direct || (owner.header_group && !is_system) ? owner.mod
+                                                          : nullptr;
+    }
+    const auto include_loc = sm.getIncludeLoc(fid);
+    if (include_loc.isInvalid()) return nullptr;
+    fid = sm.getFileID(include_loc);
+  }
+}
+
+bool ffi::ast_visitor::TraverseDecl(clang::Decl* decl) {
+  if (decl && !llvm::isa<clang::TranslationUnitDecl>(decl) &&
+      decl->getDeclContext()->getRedeclContext()->isFileContext() &&
+      !may_own(*decl))
+    return true;
+  return RecursiveASTVisitor::TraverseDecl(decl);
+}
+
+bool ffi::ast_visitor::may_own(const clang::Decl& decl) const {
+  const auto& sm = context.getSourceManager();
+  const auto begin = sm.getExpansionLoc(decl.getBeginLoc());
+  const auto end = sm.getExpansionLoc(decl.getEndLoc());
+  if (begin.isInvalid() || end.isInvalid() || owner_of(begin)) return true;
+  // Even so, a file we own may be included in the middle of it, as in
+  // 'extern "C" { #include "owned.h" }'.
+  const auto& includes = owned_includes();
+  const auto before = [&sm](clang::SourceLocation lhs,
+                            clang::SourceLocation rhs) {
+    return sm.isBeforeInTranslationUnit(lhs, rhs);
+  };
+  const auto p = std::lower_bound(includes.begin(), includes.end(), begin,
+                                  before);
+  return p != includes.end() && !before(end, *p);
+}
+
+const std::vector<clang::SourceLocation>& ffi::ast_visitor::owned_includes()
+    const {
+  if (owned_include_locs.has_value()) return *owned_include_locs;
+  // Files are entered in the order of the translation unit, and so are the
+  // locations they are included from.
+  auto& res = owned_include_locs.emplace();
+  const auto& sm = context.getSourceManager();
+  for (unsigned i = 0, n = sm.local_sloc_entry_size(); i < n; ++i) {
+    const auto& entry = sm.getLocalSLocEntry(i);
+    if (!entry.isFile()) continue;
+    const auto include_loc = entry.getFile().getIncludeLoc();
+    const auto start = clang::SourceLocation::getFromRawEncoding(
+        static_cast<unsigned>(entry.getOffset()));
+    if (include_loc.isValid() && owner_of(start))
+      res.push_back(sm.getExpansionLoc(include_loc));
+  }
+  return res;
 }
 
 bool ffi::ast_visitor::check_extern_c(const clang::Decl& decl) const {
@@ -89,36 +187,59 @@ bool ffi::ast_visitor::check_extern_c(const clang::Decl& decl) const {
 }
 
 bool ffi::ast_visitor::VisitVarDecl(clang::VarDecl* var) {
-  if (!check_decl(var)) return true;
-  if (auto v = match_var(*var)) mod.entities.emplace(std::move(*v));
+  const auto mod = check_decl(var);
+  if (!mod) return true;
+  if (auto v = match_var(*var))
+    mod->entities.emplace(v->first, entity_info{v->second});
   return true;
 }
 
 bool ffi::ast_visitor::VisitEnumDecl(clang::EnumDecl* enm) {
-  if (!check_decl(enm)) return true;
-  if (auto e = match_enum(*enm)) mod.tags.emplace(std::move(*e));
+  const auto mod = check_decl(enm);
+  if (!mod) return true;
+  if (auto e = match_enum(*enm)) mod->tags.emplace(std::move(*e));
   return true;
 }
 
 bool ffi::ast_visitor::VisitRecordDecl(clang::RecordDecl* record) {
-  if (!check_decl(record)) return true;
-  if (auto r = match_struct(*record)) mod.tags.emplace(std::move(*r));
+  const auto mod = check_decl(record);
+  if (!mod) return true;
+  if (auto r = match_struct(*record)) mod->tags.emplace(std::move(*r));
   return true;
 }
 
 bool ffi::ast_visitor::VisitFunctionDecl(clang::FunctionDecl* function) {
-  if (!check_decl(function)) return true;
-  if (auto f = match_function(*function)) mod.entities.emplace(std::move(*f));
+  const auto mod = check_decl(function);
+  if (!mod) return true;
+  if (auto f = match_function(*function))
+    mod->entities.emplace(
+        f->first, entity_info{f->second, is_unsafe_call(*function),
+                              is_pure_call(*function, *f->second)});
   return true;
 }
 
 bool ffi::ast_visitor::VisitTypedefNameDecl(clang::TypedefNameDecl* alias) {
-  if (!check_decl(alias)) return true;
-  if (auto t = match_typedef(*alias)) mod.tags.emplace(std::move(*t));
+  const auto mod = check_decl(alias);
+  if (!mod) return true;
+  if (auto t = match_typedef(*alias)) mod->tags.emplace(std::move(*t));
   return true;
 }
 
-std::optional<ffi::ctype> ffi::ast_visitor::match_type(
+const ffi::ctype* ffi::ast_visitor::match_type(const clang::NamedDecl& decl,
+                                               const clang::Type& type) const {
+  // The result only depends on the type: 'decl' only shows in diagnostics,
+  // which are only reported on failure, and failures are not cached.
+  if (const auto p = type_cache.find(&type); p != type_cache.end()) {
+    ++cache_hits;
+    return p->second;
+  }
+  ++cache_misses;
+  const auto res = match_type_uncached(decl, type);
+  if (res) type_cache.try_emplace(&type, res);
+  return res;
+}
+
+const ffi::ctype* ffi::ast_visitor::match_type_uncached(
     const clang::NamedDecl& decl, const clang::Type& type) const {
   auto& sm = context.getSourceManager();
   auto& diags = context.getDiagnostics();
@@ -126,24 +247,25 @@ std::optional<ffi::ctype> ffi::ast_visitor::match_type(
     auto typeDecl = typedefType->getDecl();
     auto qualType = typeDecl->getUnderlyingType();
     auto tk = match_type(*typeDecl, *qualType.getTypePtr());
-    if (!tk.has_value()) {
+    if (!tk) {
       const auto id =
           diags.getCustomDiagID(clang::DiagnosticsEngine::Note,
                                 "in typedef declaration for type alias '%0'.");
       diags.Report(typeDecl->getLocation(), id) << typeDecl->getName();
-      return std::nullopt;
+      return nullptr;
     }
-    auto& resVal = tk.value().value;
-    if (std::holds_alternative<scalar_type>(resVal)) {
+    // The underlying type is interned, make a new node for any refinement.
+    if (std::holds_alternative<scalar_type>(tk->value)) {
       auto name = typeDecl->getName().str();
       if (sm.isInSystemHeader(typeDecl->getLocation()) ||
           cfg.allow_custom_fixed_size_int)
         if (auto tn = scalar_type::from_name(name); tn.has_value())
-          tk = {tn.value()};
-    } else if (std::holds_alternative<opaque_type>(resVal)) {
+          return types.intern(ctype{tn.value()});
+    } else if (const auto opaque = std::get_if<opaque_type>(&tk->value);
+               opaque && opaque->name.empty()) {
       auto name = typeDecl->getQualifiedNameAsString();
-      auto& opaque = std::get<opaque_type>(resVal);
-      if (opaque.name.empty()) opaque.name = name;
+      return types.intern(
+          ctype{opaque_type{std::move(name), opaque->marshallable}});
     }
     return tk;
   }
@@ -156,15 +278,15 @@ std::optional<ffi::ctype> ffi::ast_visitor::match_type(
           "declaration for entity '%0' is ignored, type '%2' is an "
           "OpenCL type, a platform extension, or a clang extension.");
       diags.Report(decl.getLocation(), id) << decl.getName() << name_of(k);
-      return std::nullopt;
+      return nullptr;
     }
-    return ctype{std::move(tk.value())};
+    return types.intern(ctype{tk.value()});
   }
   if (auto pointerType = type.getAs<clang::PointerType>()) {
     auto pointee = pointerType->getPointeeType();
     auto tk = match_type(decl, *pointee.getTypePtr());
-    if (!tk.has_value()) return std::nullopt;
-    return ctype{pointer_type{std::make_unique<ctype>(std::move(tk.value()))}};
+    if (!tk) return nullptr;
+    return types.intern(ctype{pointer_type{tk}});
   }
   if (type.getAs<clang::ReferenceType>()) {
     const auto id = diags.getCustomDiagID(
@@ -172,19 +294,20 @@ std::optional<ffi::ctype> ffi::ast_visitor::match_type(
         "declaration for entity '%0' involving C++ reference is ignored, "
         "because C++ references (lvalue, rvalue) are not supported.");
     diags.Report(decl.getLocation(), id) << decl.getName();
-    return std::nullopt;
+    return nullptr;
   }
   if (auto templType = type.getAs<clang::TemplateSpecializationType>()) {
     auto templName = templType->getTemplateName();
     std::string typeName;
     llvm::raw_string_ostream os{typeName};
     templName.print(os, context.getPrintingPolicy());
-    return ctype{opaque_type{typeName}};
+    return types.intern(ctype{opaque_type{typeName}});
   }
   if (auto tagType = type.getAs<clang::TagType>()) {
     auto tagDecl = tagType->getDecl();
     auto tagName = tagDecl->getName();
-    return ctype{opaque_type{tagName, llvm::isa<clang::EnumType>(tagType)}};
+    return types.intern(
+        ctype{opaque_type{tagName, llvm::isa<clang::EnumType>(tagType)}});
   }
   if (auto funcType = type.getAs<clang::FunctionProtoType>()) {
     if (funcType->getCallConv() != clang::CC_C) {
@@ -193,35 +316,35 @@ std::optional<ffi::ctype> ffi::ast_visitor::match_type(
           "declaration for match_function pointer '%0' is ignored, because it "
           "does not have a C calling convention.");
       diags.Report(decl.getLocation(), id) << decl.getName();
-      return std::nullopt;
+      return nullptr;
     }
 
     function_type func{};
     auto retType = match_type(decl, *funcType->getReturnType().getTypePtr());
-    if (!retType.has_value()) {
+    if (!retType) {
       const auto id = diags.getCustomDiagID(
           clang::DiagnosticsEngine::Note,
           "in declaration for return type of match_function '%0'.");
       diags.Report(decl.getLocation(), id) << decl.getName();
-      return std::nullopt;
+      return nullptr;
     }
-    func.return_type = std::make_unique<ctype>(std::move(retType.value()));
+    func.return_type = retType;
 
     auto paramCount = funcType->getNumParams();
     for (auto i = 0; i < paramCount; ++i) {
       auto param = funcType->getParamType(i);
       auto paramType = match_type(decl, *param.getTypePtr());
-      if (!paramType.has_value()) {
+      if (!paramType) {
         const auto id = diags.getCustomDiagID(
             clang::DiagnosticsEngine::Note,
             "in declaration for parameter type %1 of match_function '%0'.");
         diags.Report(decl.getLocation(), id) << decl.getName() << i;
-        return std::nullopt;
+        return nullptr;
       }
-      func.params.emplace_back("", std::move(paramType.value()));
+      func.params.emplace_back("", paramType);
     }
 
-    return ctype{std::move(func)};
+    return types.intern(ctype{std::move(func)});
   }
 
   const auto id = diags.getCustomDiagID(
@@ -229,14 +352,14 @@ std::optional<ffi::ctype> ffi::ast_visitor::match_type(
       "declaration for entity '%0' is ignored for no good reason, please "
       "consider this as a bug, and report to the author.");
   diags.Report(decl.getLocation(), id) << decl.getName();
-  return std::nullopt;
+  return nullptr;
 }
 
 std::optional<ffi::entity> ffi::ast_visitor::match_var_raw(
     const clang::VarDecl& decl) const {
   auto type = match_type(decl, *decl.getType().getTypePtr());
-  if (!type.has_value()) return std::nullopt;
-  if (!is_marshallable(type.value())) {
+  if (!type) return std::nullopt;
+  if (!is_marshallable(*type)) {
     auto& diags = context.getDiagnostics();
     const auto id = diags.getCustomDiagID(
         clang::DiagnosticsEngine::Warning,
@@ -246,7 +369,7 @@ std::optional<ffi::entity> ffi::ast_visitor::match_var_raw(
     diags.Report(decl.getLocation(), id);
     return std::nullopt;
   }
-  return entity{decl.getName(), std::move(type.value())};
+  return entity{types.intern(decl.getName()), type};
 }
 
 std::optional<ffi::entity> ffi::ast_visitor::match_var(
@@ -275,15 +398,53 @@ std::optional<ffi::entity> ffi::ast_visitor::match_function(
 
   function_type func{};
   auto retType = match_type(decl, *decl.getReturnType().getTypePtr());
-  if (!retType.has_value()) return reportNote();
-  func.return_type = std::make_unique<ctype>(std::move(retType.value()));
+  if (!retType) return reportNote();
+  func.return_type = retType;
   for (auto param : decl.parameters()) {
     auto var = match_param(*param);
     if (!var.has_value()) return reportNote();
     func.params.push_back(std::move(var.value()));
   }
 
-  return entity{name, ctype{std::move(func)}};
+  return entity{types.intern(name), types.intern(ctype{std::move(func)})};
+}
+
+bool ffi::ast_visitor::is_unsafe_call(const clang::FunctionDecl& decl) const {
+  const auto name = decl.getName();
+  const auto matches = [name](const std::vector<llvm::GlobPattern>& globs) {
+    return llvm::any_of(globs, [name](const auto& g) { return g.match(name); });
+  };
+  if (matches(safe_globs)) return false;
+  if (matches(unsafe_globs)) return true;
+#if LLVM_VERSION_MAJOR >= 12
+  if (decl.hasAttr<clang::LeafAttr>()) return true;
+#endif
+  // 'const' and 'pure' functions may still call a function they are given,
+  // and 'nothrow' says nothing about callbacks at all.
+  if (!decl.hasAttr<clang::ConstAttr>() && !decl.hasAttr<clang::PureAttr>())
+    return false;
+  llvm::SmallPtrSet<const clang::RecordDecl*, 4> seen;
+  return llvm::none_of(decl.parameters(), [&seen](const clang::ParmVarDecl* p) {
+    return has_function_pointer(p->getType(), seen);
+  });
+}
+
+bool ffi::ast_visitor::is_pure_call(const clang::FunctionDecl& decl,
+                                    const ctype& type) const {
+  const auto name = decl.getName();
+  if (llvm::any_of(pure_globs, [name](const auto& g) { return g.match(name); }))
+    return true;
+  // 'pure' functions may read memory, which can change between calls.
+  if (!decl.hasAttr<clang::ConstAttr>()) return false;
+  const auto& func = std::get<function_type>(type.value);
+  const auto is_scalar = [](const ctype* t) {
+    const auto s = std::get_if<scalar_type>(&t->value);
+    return s && s->qualifier != scalar_type::Void;
+  };
+  return is_scalar(func.return_type) &&
+         llvm::all_of(func.params, [&](const entity& p) {
+           return is_scalar(p.second);
+         });
 }
 
 std::optional<ffi::tag_decl> ffi::ast_visitor::match_enum(
@@ -304,7 +465,7 @@ std::optional<ffi::tag_decl> ffi::ast_visitor::match_enum(
     name = def_name;
   }
   auto type = match_type(decl, *decl.getIntegerType().getTypePtr());
-  if (!type.has_value()) {
+  if (!type) {
     const auto id =
         diags.getCustomDiagID(clang::DiagnosticsEngine::Note,
                               "in the underlying type for enumeration '%0'.");
@@ -313,7 +474,7 @@ std::optional<ffi::tag_decl> ffi::ast_visitor::match_enum(
   }
 
   enumeration enm;
-  enm.underlying_type = std::move(type.value());
+  enm.underlying_type = type;
   for (const auto* item : decl.enumerators()) {
     auto itemName = item->getName();
     auto initVal = item->getInitVal().getExtValue();
@@ -340,10 +501,34 @@ std::optional<ffi::tag_decl> ffi::ast_visitor::match_struct(
   }
 
   structure record;
+  bool has_bit_fields = false;
   for (const auto* f : decl.fields()) {
     auto type = match_type(*f, *f->getType().getTypePtr());
-    if (!type.has_value()) return std::nullopt;
-    record.fields.emplace_back(f->getName(), std::move(type.value()));
+    if (!type) return std::nullopt;
+    record.fields.emplace_back(types.intern(f->getName()), type);
+    has_bit_fields = has_bit_fields || f->isBitField();
+  }
+
+  if (decl.isThisDeclarationADefinition() && !decl.isInvalidDecl() &&
+      !decl.isDependentType()) {
+    if (!has_bit_fields) {
+      const auto& layout = context.getASTRecordLayout(&decl);
+      record_layout res;
+      res.size = layout.getSize().getQuantity();
+      res.alignment = layout.getAlignment().getQuantity();
+      for (const auto* f : decl.fields()) {
+        const auto bits = layout.getFieldOffset(f->getFieldIndex());
+        res.offsets.push_back(context.toCharUnitsFromBits(bits).getQuantity());
+      }
+      record.layout = std::move(res);
+    } else if (cfg.generate_storable_instances) {
+      auto& diags = context.getDiagnostics();
+      const auto id = diags.getCustomDiagID(
+          clang::DiagnosticsEngine::Warning,
+          "struct '%0' has bit-fields, the layout in its Storable instance "
+          "is not reliable.");
+      diags.Report(decl.getLocation(), id) << name;
+    }
   }
 
   return tag_decl{name, tag_type{std::move(record)}};
@@ -18,32 +18,57 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <llvm/ADT/DenseMap.h>
 
 #include "config.h"
 #include "module.h"
 #include "tag_type.h"
+#include "type_arena.h"
 #include "types.h"
 
 namespace ffi {
+// A file we generate a module for. Declarations in a header group also
+// include those in (non-system) headers it includes.
+struct module_owner {
+  module_contents* mod;
+  bool header_group;
+};
+using owner_map = llvm::DenseMap<const clang::FileEntry*, module_owner>;
+
 class ast_visitor : public clang::RecursiveASTVisitor<ast_visitor> {
  public:
-  ast_visitor(config& cfg, module_contents& mod, clang::ASTContext& context,
-              bool header_group)
-      : header_group{header_group}, cfg{cfg}, mod{mod}, context{context} {}
+  ast_visitor(config& cfg, type_arena& types, const owner_map& owners,
+              clang::ASTContext& context)
+      : cfg{cfg},
+        types{types},
+        owners{owners},
+        context{context},
+        unsafe_globs{make_globs(cfg.unsafe_calls)},
+        safe_globs{make_globs(cfg.safe_calls)},
+        pure_globs{make_globs(cfg.pure_calls)} {}
 
-  [[nodiscard]] bool check_decl(const clang::Decl* decl) const;
+  // The module a declaration goes to, or nullptr if it should be ignored.
+  [[nodiscard]] module_contents* check_decl(const clang::Decl* decl) const;
+  // Decisions are made once per file.
+  [[nodiscard]] module_contents* owner_of(clang::SourceLocation loc) const;
   [[nodiscard]] bool check_extern_c(const clang::Decl& decl) const;
 
+  // Skip declarations at file scope (including namespaces and linkage
+  // specifications) which cannot contain anything going to a module.
+  bool TraverseDecl(clang::Decl* decl);
+
   bool VisitVarDecl(clang::VarDecl* var);
   bool VisitEnumDecl(clang::EnumDecl* enm);
   bool VisitRecordDecl(clang::RecordDecl* record);
   bool VisitFunctionDecl(clang::FunctionDecl* function);
   bool VisitTypedefNameDecl(clang::TypedefNameDecl* alias);
 
-  [[nodiscard]] std::optional<ctype> match_type(const clang::NamedDecl& decl,
-                                                const clang::Type& type) const;
+  // Types are memoized, so the same clang::Type* always gives the same node.
+  [[nodiscard]] const ctype* match_type(const clang::NamedDecl& decl,
+                                        const clang::Type& type) const;
   [[nodiscard]] std::optional<entity> match_var_raw(
       const clang::VarDecl& decl) const;
   [[nodiscard]] std::optional<entity> match_var(
@@ -52,6 +77,14 @@ class ast_visitor : public clang::RecursiveASTVisitor<ast_visitor> {
       const clang::ParmVarDecl& param) const;
   [[nodiscard]] std::optional<entity> match_function(
       const clang::FunctionDecl& decl) const;
+  // Whether a function is safe to import with 'ccall unsafe', by the globs
+  // in the configuration, or by attributes implying it does not call back:
+  // 'leaf', or 'const' and 'pure' without function pointers in parameters.
+  [[nodiscard]] bool is_unsafe_call(const clang::FunctionDecl& decl) const;
+  // Whether a function is safe to import without 'IO', by the globs in the
+  // configuration, or if it is 'const' and takes and returns only scalars.
+  [[nodiscard]] bool is_pure_call(const clang::FunctionDecl& decl,
+                                  const ctype& type) const;
   [[nodiscard]] std::optional<tag_decl> match_enum(
       const clang::EnumDecl& decl, llvm::StringRef def_name = {}) const;
   [[nodiscard]] std::optional<tag_decl> match_struct(
@@ -59,10 +92,28 @@ class ast_visitor : public clang::RecursiveASTVisitor<ast_visitor> {
   [[nodiscard]] std::optional<tag_decl> match_typedef(
       const clang::TypedefNameDecl& decl) const;
 
+  [[nodiscard]] size_t type_cache_hits() const { return cache_hits; }
+  [[nodiscard]] size_t type_cache_misses() const { return cache_misses; }
+
  private:
-  bool header_group;
+  [[nodiscard]] const ctype* match_type_uncached(
+      const clang::NamedDecl& decl, const clang::Type& type) const;
+  [[nodiscard]] module_contents* find_owner(clang::FileID fid) const;
+  [[nodiscard]] bool may_own(const clang::Decl& decl) const;
+  [[nodiscard]] const std::vector<clang::SourceLocation>& owned_includes()
+      const;
+
   config& cfg;
-  module_contents& mod;
+  type_arena& types;
+  const owner_map& owners;
   clang::ASTContext& context;
+  std::vector<llvm::GlobPattern> unsafe_globs;
+  std::vector<llvm::GlobPattern> safe_globs;
+  std::vector<llvm::GlobPattern> pure_globs;
+  mutable llvm::DenseMap<const clang::Type*, const ctype*> type_cache;
+  mutable size_t cache_hits{0};
+  mutable size_t cache_misses{0};
+  mutable llvm::DenseMap<clang::FileID, module_contents*> file_owners;
+  mutable std::optional<std::vector<clang::SourceLocation>> owned_include_locs;
 };
 }  // namespace ffi
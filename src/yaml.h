@@ -25,21 +25,24 @@
 
 #include "config.h"
 #include "function_type.h"
+#include "manifest.h"
 #include "module.h"
 #include "name_converter.h"
 #include "opaque_type.h"
 #include "pointer_type.h"
 #include "prim_types.h"
 #include "tag_type.h"
+#include "type_arena.h"
 #include "types.h"
 
-template <typename T>
-struct llvm::yaml::MappingTraits<std::unique_ptr<T>> {
-  static void mapping(IO& io, std::unique_ptr<T>& p) {
-    if (!io.outputting()) p.reset(new T);
-    MappingTraits<T>::mapping(io, *p);
-  }
-};
+namespace ffi {
+// Types read from YAML are interned in the arena passed as the IO context.
+inline type_arena* yaml_arena(llvm::yaml::IO& io) {
+  const auto arena = static_cast<type_arena*>(io.getContext());
+  if (!arena) io.setError("no type arena to read types into");
+  return arena;
+}
+}  // namespace ffi
 
 template <>
 struct llvm::yaml::MappingTraits<ffi::function_type> {
@@ -83,10 +86,42 @@ struct llvm::yaml::MappingTraits<ffi::ctype> {
   }
 };
 
+template <>
+struct llvm::yaml::MappingTraits<const ffi::ctype*> {
+  static void mapping(IO& io, const ffi::ctype*& type) {
+    if (io.outputting()) {
+      // outputting never modifies the node
+      MappingTraits<ffi::ctype>::mapping(io, const_cast<ffi::ctype&>(*type));
+      return;
+    }
+    ffi::ctype node;
+    MappingTraits<ffi::ctype>::mapping(io, node);
+    if (const auto arena = ffi::yaml_arena(io))
+      type = arena->intern(std::move(node));
+  }
+};
+
+template <>
+struct llvm::yaml::MappingTraits<ffi::record_layout> {
+  static void mapping(IO& io, ffi::record_layout& layout) {
+    io.mapRequired("size", layout.size);
+    io.mapRequired("alignment", layout.alignment);
+    io.mapRequired("offsets", layout.offsets);
+  }
+};
+
 template <>
 struct llvm::yaml::MappingTraits<ffi::structure> {
   static void mapping(IO& io, ffi::structure& tag) {
     io.mapRequired("fields", tag.fields);
+    if (io.outputting()) {
+      if (tag.layout.has_value()) io.mapRequired("layout", *tag.layout);
+      return;
+    }
+    // Alignment is at least 1 if there is a layout.
+    ffi::record_layout layout;
+    io.mapOptional("layout", layout);
+    if (layout.alignment != 0) tag.layout = std::move(layout);
   }
 };
 
@@ -128,12 +163,25 @@ struct llvm::yaml::MappingTraits<ffi::tag_type> {
 template <>
 struct llvm::yaml::MappingTraits<ffi::entity> {
   static void mapping(IO& io, ffi::entity& entity) {
-    io.mapRequired("name", entity.first);
+    StringRef name{entity.first.data(), entity.first.size()};
+    io.mapRequired("name", name);
     io.mapRequired("type", entity.second);
+    if (!io.outputting())
+      if (const auto arena = ffi::yaml_arena(io))
+        entity.first = arena->intern(name);
   }
 };
 LLVM_YAML_IS_SEQUENCE_VECTOR(ffi::entity)
 
+template <>
+struct llvm::yaml::MappingTraits<ffi::entity_info> {
+  static void mapping(IO& io, ffi::entity_info& info) {
+    io.mapRequired("type", info.type);
+    io.mapOptional("unsafe", info.unsafe, false);
+    io.mapOptional("pure", info.pure, false);
+  }
+};
+
 template <>
 struct llvm::yaml::MappingTraits<ffi::module_contents> {
   static void mapping(IO& io, ffi::module_contents& mod) {
@@ -155,25 +203,45 @@ struct llvm::yaml::CustomMappingTraits<std::map<std::string, T, C>> {
   }
 };
 
-template <typename T, typename C>
-struct llvm::yaml::CustomMappingTraits<std::map<ffi::scoped_name, T, C>> {
-  static void inputOne(IO& io, StringRef key,
-                       std::map<ffi::scoped_name, T, C>& m) {
+template <>
+struct llvm::yaml::CustomMappingTraits<ffi::name_table> {
+  static void inputOne(IO& io, StringRef key, ffi::name_table& m) {
     const auto p = key.find('.');
     if (p == StringRef::npos) {
       // no scope provided
-      ffi::scoped_name nm{{}, key.str()};
-      io.mapRequired(nm.name.c_str(), m[nm]);
+      const auto e = m.try_emplace({{}, {key.data(), key.size()}}).first;
+      io.mapRequired(e->name.c_str(), e->value);
     } else if (key.size() <= p + 1 || key.find('.', p + 1) != StringRef::npos) {
       io.setError(fmt::format("invalid scoped name '{}'", key.str()));
     } else {
-      ffi::scoped_name nm{key.substr(0, p).str(), key.substr(p + 1).str()};
-      io.mapRequired(key.str().c_str(), m[nm]);
+      const auto scope = key.substr(0, p), name = key.substr(p + 1);
+      const auto e = m.try_emplace({{scope.data(), scope.size()},
+                                    {name.data(), name.size()}})
+                         .first;
+      io.mapRequired(key.str().c_str(), e->value);
     }
   }
 
-  static void output(IO& io, std::map<ffi::scoped_name, T, C>& m) {
-    for (auto& [k, v] : m) io.mapRequired(fmt::to_string(k).c_str(), v);
+  static void output(IO& io, ffi::name_table& m) {
+    for (const auto e : m.sorted())
+      io.mapRequired(fmt::to_string(e->key()).c_str(),
+                     const_cast<std::string&>(e->value));
+  }
+};
+
+template <>
+struct llvm::yaml::MappingTraits<ffi::manifest_entry> {
+  static void mapping(IO& io, ffi::manifest_entry& entry) {
+    io.mapRequired("fingerprint", entry.fingerprint);
+    io.mapRequired("output", entry.output);
+    io.mapRequired("dependencies", entry.dependencies);
+  }
+};
+
+template <>
+struct llvm::yaml::MappingTraits<ffi::manifest> {
+  static void mapping(IO& io, ffi::manifest& m) {
+    io.mapRequired("modules", m.modules);
   }
 };
 
@@ -0,0 +1,60 @@
+# Generate 'fixtures/default_template.h' with the native emitter, with the
+# default template as a custom template through inja, and with the default
+# template compiled into auto-ffi-compiled, then compare the output files byte
+# for byte. The same again with trim_blocks, without the native emitter.
+# Arguments: AUTO_FFI, AUTO_FFI_COMPILED, TEMPLATE, FIXTURES, WORK_DIR.
+set(native_program ${AUTO_FFI})
+set(native_options "")
+set(inja_program ${AUTO_FFI})
+set(inja_options "custom_template: '${TEMPLATE}'\n")
+set(compiled_program ${AUTO_FFI_COMPILED})
+set(compiled_options "compiled_template: default_template\n")
+set(inja_trimmed_program ${AUTO_FFI})
+set(inja_trimmed_options
+  "custom_template: '${TEMPLATE}'\ninja_set_trim_blocks: true\n")
+set(compiled_trimmed_program ${AUTO_FFI_COMPILED})
+set(compiled_trimmed_options "compiled_template: default_template_trimmed\n")
+
+foreach(mode native inja compiled inja_trimmed compiled_trimmed)
+  set(output "${WORK_DIR}/${mode}")
+  file(REMOVE_RECURSE ${output})
+  set(config "${WORK_DIR}/${mode}.yaml")
+  file(WRITE ${config}
+    "library_name: Fixture\n"
+    "root_directory: '${FIXTURES}'\n"
+    "output_directory: '${output}'\n"
+    "allow_custom_fixed_size_int: true\n"
+    "file_names: [default_template.h]\n"
+    "unsafe_calls: ['fast_*']\n"
+    "pure_calls: ['pure_*']\n"
+    "${${mode}_options}")
+  execute_process(COMMAND ${${mode}_program} ${config}
+    RESULT_VARIABLE status)
+  if(status)
+    message(FATAL_ERROR "auto-ffi fails on '${config}': ${status}")
+  endif()
+  file(GLOB_RECURSE ${mode}_files RELATIVE ${output} "${output}/*.hs")
+endforeach()
+
+# Fail unless 'mode' generated the same files as 'expected'
+function(compare_outputs expected mode)
+  if(NOT ${expected}_files)
+    message(FATAL_ERROR "No module generated by ${expected}.")
+  endif()
+  if(NOT ${expected}_files STREQUAL ${mode}_files)
+    message(FATAL_ERROR "Different modules generated by ${expected} and "
+      "${mode}:\n${${expected}_files}\n${${mode}_files}")
+  endif()
+  foreach(f IN LISTS ${expected}_files)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+      "${WORK_DIR}/${expected}/${f}" "${WORK_DIR}/${mode}/${f}"
+      RESULT_VARIABLE different)
+    if(different)
+      message(FATAL_ERROR "'${f}' differs between ${expected} and ${mode}.")
+    endif()
+  endforeach()
+endfunction()
+
+compare_outputs(native inja)
+compare_outputs(native compiled)
+compare_outputs(inja_trimmed compiled_trimmed)
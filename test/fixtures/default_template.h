@@ -0,0 +1,58 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Declarations covering every part of the default template, see
+ * 'default_template.cmake'. No system headers, so that the test does not
+ * depend on where the Clang resource directory is. */
+
+typedef signed char int8_t;
+typedef unsigned int uint32_t;
+typedef long long int64_t;
+typedef unsigned long size_t;
+
+struct point {
+  int x;
+  int y;
+};
+
+struct buffer {
+  char* data;
+  size_t size;
+  uint32_t flags;
+  const struct point* origin;
+  void (*on_free)(void* data, size_t size);
+};
+
+struct empty {};
+
+struct handle;
+
+enum color { color_red, color_green = 4, color_blue };
+
+typedef enum { mode_read = 1, mode_write = 2 } mode;
+
+struct handle* handle_open(const char* path, mode m);
+void handle_close(struct handle* h);
+int64_t handle_seek(struct handle* h, int64_t offset, int8_t whence);
+void buffer_fill(struct buffer* b, enum color c);
+struct point point_add(struct point a, struct point b);
+int fast_abs(int x) __attribute__((const));
+double pure_norm(const struct point* p);
+int find_first(const struct buffer* b, int (*match)(char c))
+    __attribute__((pure));
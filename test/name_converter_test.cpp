@@ -0,0 +1,148 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Checks for 'name_converter'. With '--bench', also times the conversions of
+// camel case, snake case, and prefixed names.
+
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include "name_converter.h"
+
+namespace {
+using ffi::name_case;
+using ffi::name_converter;
+using ffi::name_variant;
+
+name_converter make_converter(name_case c, name_variant v = {},
+                              std::string remove_prefix = {},
+                              std::string remove_suffix = {}) {
+  name_converter res;
+  res.output_case = c;
+  res.output_variant = v;
+  res.remove_prefix = std::move(remove_prefix);
+  res.remove_suffix = std::move(remove_suffix);
+  return res;
+}
+
+const name_converter camel = make_converter(name_case::camel);
+const name_converter lower = make_converter(name_case::snake_all_lower);
+const name_converter upper = make_converter(name_case::snake_all_upper);
+const name_converter type_ctor =
+    make_converter(name_case::camel, name_variant::type_ctor, "lib_", "_t");
+const name_converter variable =
+    make_converter(name_case::camel, name_variant::variable, "LIB_");
+
+struct conversion {
+  const name_converter& conv;
+  std::string_view name;
+  std::string_view expected;
+};
+
+const conversion cases[]{
+    // Words break before an upper case letter following a lower case one.
+    {camel, "fooBar", "FooBar"},
+    {camel, "fooBarBaz", "FooBarBaz"},
+    {camel, "FooBar", "FooBar"},
+    {camel, "fooBAR", "FooBar"},
+    {camel, "getHTTPResponse", "GetHTTPResponse"},
+    {camel, "HTTPServer", "HTTPServer"},
+    {camel, "parseURL2Json", "ParseURL2Json"},
+    {camel, "aB", "AB"},
+    {camel, "x", "X"},
+    // Words also break at anything but letters and digits.
+    {camel, "foo_bar", "FooBar"},
+    {camel, "foo__bar", "FooBar"},
+    {camel, "_foo", "Foo"},
+    {camel, "foo_", "Foo"},
+    {camel, "FOO_BAR", "FooBar"},
+    {camel, "a1_b2", "A1B2"},
+    {lower, "fooBar_Baz", "foobarbaz"},
+    {upper, "fooBar_baz", "FOOBARBAZ"},
+    // Prefixes and suffixes are removed before the conversion.
+    {type_ctor, "lib_foo_bar_t", "FooBar"},
+    {type_ctor, "lib_foo", "Foo"},
+    {type_ctor, "foo_t", "Foo"},
+    {type_ctor, "foo_bar", "FooBar"},
+    {type_ctor, "lib_t", "T"},
+    {type_ctor, "my_lib_foo", "MyLibFoo"},
+    {type_ctor, "foo_t_bar", "FooTBar"},
+    {variable, "LIB_fooBar", "fooBar"},
+    {variable, "LIB_FOO_BAR", "fooBar"},
+    {variable, "fooBar_LIB_", "fooBarLib"},
+};
+
+int check() {
+  int failures = 0;
+  std::string buffer;
+  for (const auto& c : cases) {
+    const auto res = c.conv.convert(c.name);
+    buffer.assign(c.name);
+    c.conv.convert_in_place(buffer);
+    if (res == c.expected && buffer == c.expected) continue;
+    fmt::print(stderr,
+               "convert(\"{}\"): expected \"{}\", got \"{}\" and \"{}\".\n",
+               c.name, c.expected, res, buffer);
+    ++failures;
+  }
+  return failures;
+}
+
+double time_per_name(const name_converter& conv,
+                     const std::string_view (&names)[4]) {
+  constexpr int rounds = 250000;
+  std::string buffer;
+  size_t length = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; ++i)
+    for (const auto name : names) {
+      buffer.assign(name);
+      conv.convert_in_place(buffer);
+      length += buffer.size();
+    }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // Keep the conversions from being optimized out.
+  if (length == 0) fmt::print(stderr, "Nothing converted.\n");
+  return elapsed.count() / (rounds * std::size(names));
+}
+
+void bench() {
+  constexpr std::string_view camel_names[]{
+      "getHTTPResponse", "fooBarBaz", "parseURL2Json", "setWindowTitle"};
+  constexpr std::string_view snake_names[]{
+      "foo_bar_baz", "get_http_response", "set_window_title", "x"};
+  constexpr std::string_view prefixed_names[]{
+      "lib_foo_bar_t", "lib_window_t", "lib_http_response_t", "foo_t"};
+  fmt::print("camel case:    {:.1f} ns/name\n",
+             time_per_name(camel, camel_names));
+  fmt::print("snake case:    {:.1f} ns/name\n",
+             time_per_name(upper, snake_names));
+  fmt::print("prefix/suffix: {:.1f} ns/name\n",
+             time_per_name(type_ctor, prefixed_names));
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const auto failures = check();
+  if (argc > 1 && std::string_view{argv[1]} == "--bench") bench();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/* This file is part of auto-FFI (https://github.com/Krantz-XRF/auto-FFI).
+ * Copyright (C) 2020 Xie Ruifeng
+ *
+ * auto-FFI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * auto-FFI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with auto-FFI.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Checks for 'scalar_type::from_name'. With '--bench', also times it against
+// the regular expression it replaces.
+
+#include <chrono>
+#include <iterator>
+#include <optional>
+#include <regex>
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include "prim_types.h"
+
+namespace {
+struct typedef_case {
+  std::string_view name;
+  std::optional<std::string_view> haskell;
+};
+
+constexpr typedef_case cases[]{
+    // Names with a fixed meaning
+    {"wchar_t", "CWchar"},
+    {"char8_t", "Word8"},
+    {"char16_t", "Word16"},
+    {"char32_t", "Word32"},
+    {"size_t", "CSize"},
+    {"ptrdiff_t", "CPtrdiff"},
+    // (u)?int(ptr|max|(_(least|fast))?([1-9][0-9]*))_t
+    {"int8_t", "Int8"},
+    {"uint16_t", "Word16"},
+    {"int32_t", "Int32"},
+    {"uint64_t", "Word64"},
+    {"int_least8_t", "Int8"},
+    {"uint_least32_t", "Word32"},
+    {"int_fast16_t", "Int16"},
+    {"uint_fast64_t", "Word64"},
+    {"intptr_t", "CIntPtr"},
+    {"uintptr_t", "CUIntPtr"},
+    {"intmax_t", "CIntMax"},
+    {"uintmax_t", "CUIntMax"},
+    // Not fixed-size integers
+    {"int", std::nullopt},
+    {"int_t", std::nullopt},
+    {"int08_t", std::nullopt},
+    {"int8", std::nullopt},
+    {"uint8_t_", std::nullopt},
+    {"sint8_t", std::nullopt},
+    {"int_exact8_t", std::nullopt},
+    {"int_least_t", std::nullopt},
+    {"intptrmax_t", std::nullopt},
+    {"int8x_t", std::nullopt},
+    {"char_t", std::nullopt},
+    {"ssize_t", std::nullopt},
+    {"size", std::nullopt},
+    {"", std::nullopt},
+};
+
+int check() {
+  int failures = 0;
+  for (const auto& c : cases) {
+    const auto res = ffi::scalar_type::from_name(c.name);
+    const auto haskell = res ? std::optional{res->as_haskell()} : std::nullopt;
+    if (haskell == c.haskell) continue;
+    fmt::print(stderr, "from_name(\"{}\"): expected {}, got {}.\n", c.name,
+               c.haskell.value_or("nothing"), haskell.value_or("nothing"));
+    ++failures;
+  }
+  return failures;
+}
+
+template <typename F>
+double time_per_name(F f) {
+  constexpr int rounds = 100000;
+  size_t matched = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; ++i)
+    for (const auto& c : cases) matched += f(c.name);
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  // Keep the calls from being optimized out.
+  if (matched == 0) fmt::print(stderr, "Nothing matched.\n");
+  return elapsed.count() / (rounds * std::size(cases));
+}
+
+void bench() {
+  const std::regex reg{"(u)?int(ptr|max|(?:_(least|fast))?([1-9][0-9]*))_t",
+                       std::regex::ECMAScript | std::regex::optimize};
+  const auto regex_ns = time_per_name([&reg](std::string_view name) {
+    std::match_results<std::string_view::const_iterator> match{};
+    return std::regex_match(name.cbegin(), name.cend(), match, reg);
+  });
+  const auto from_name_ns = time_per_name([](std::string_view name) {
+    return ffi::scalar_type::from_name(name).has_value();
+  });
+  fmt::print("std::regex: {:.1f} ns/name\n", regex_ns);
+  fmt::print("from_name:  {:.1f} ns/name ({:.1f}x)\n", from_name_ns,
+             regex_ns / from_name_ns);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const auto failures = check();
+  if (argc > 1 && std::string_view{argv[1]} == "--bench") bench();
+  return failures == 0 ? 0 : 1;
+}